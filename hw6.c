@@ -1,26 +1,79 @@
+// Build: gcc -O2 -pthread hw6.c -o hw6 -lm
+// libm is for pow() in the Zipfian key generator and sqrt() in the
+// thread-count sweep.
+
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
 #define SOL
 #define NBUCKET 5
 #define NKEYS 100000
 
-pthread_mutex_t locks[NBUCKET];
-
-struct entry {
-  int key;
-  int value;
-  struct entry *next;
-};
-struct entry *table[NBUCKET];
-int keys[NKEYS];
+int nkeys = NKEYS;
+int nbucket = NBUCKET;
 int nthread = 1;
-volatile int done;
+int bulkload;
+int interleave;
+double bloomfpr;
+int missphase;
+double zipftheta;
+int combining;
+int quiet;
+int stats;
+int snapshot;
+int delegate;
+int cachemisses;
+long walinterval = -1;
+const char *walpath = "hw6.wal";
+long capacity;
+long ttl;
+const char *keypath;
+const char *genpath;
+const char *recordpath;
+const char *replaypath;
+int paced;
+int hashbench;
+long uringdepth;
+int nproc;
+int freeze;
+int hashjoin;
+int aggregate;
+const char *servepath;
+const char *loadpath;
+long pipeline = 64;
+int deletes;
 
+// Wall-clock seconds of each phase, from the barrier that starts it until
+// its last thread is done; keys not found by get, absent keys found
+// anyway by the miss phase, and cache misses of the put and get phases
+// (-1 if not counted).
+struct bench {
+  double put;
+  double get;
+  double miss;
+  long missing;
+  long found;
+  long putcache;
+  long getcache;
+  long commits;                 // write-ahead log commits during the puts
+};
 
 double
 now()
@@ -30,112 +83,804 @@ now()
  return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
+// A cycle count: the TSC where there is one, else nanoseconds.
+static inline uint64_t
+cycles(void)
+{
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return now() * 1e9;
+#endif
+}
+
+// A barrier for n threads that spins, yielding, since MacOS has no
+// pthread_barrier. The last thread to arrive notes the time and releases
+// the rest, and every thread gets that time back, so a phase timed from
+// it counts threads still waiting for a core.
+struct spinbarrier {
+  volatile int arrived;
+  volatile int gen;
+  double released;
+};
+
+static double
+spinbarrier_wait(struct spinbarrier *b, int n)
+{
+  int gen = b->gen;
+
+  if (__sync_add_and_fetch(&b->arrived, 1) == n) {
+    b->arrived = 0;
+    b->released = now();
+    __sync_synchronize();
+    b->gen = gen + 1;
+  } else {
+    while (b->gen == gen) sched_yield();
+  }
+  return b->released;
+}
+
+// Hardware cache-miss counter of the calling thread, or -1 if the
+// machine or its perf_event_paranoid setting doesn't allow one.
+static int
+perf_open(void)
+{
+  struct perf_event_attr a;
+
+  memset(&a, 0, sizeof(a));
+  a.type = PERF_TYPE_HARDWARE;
+  a.size = sizeof(a);
+  a.config = PERF_COUNT_HW_CACHE_MISSES;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+static long
+perf_read(int fd)
+{
+  long long v;
+
+  if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v)) return -1;
+  return v;
+}
+
+// Misses since perf_read(fd) returned c0, or -1.
+static long
+perf_since(int fd, long c0)
+{
+  long c = perf_read(fd);
+  return c0 < 0 || c < 0 ? -1 : c - c0;
+}
+
+// Resident kB of this process, or with addr, of its mapping that starts
+// at addr; -1 if /proc doesn't say.
+static long
+rss_kb(void *addr)
+{
+  FILE *f = fopen(addr ? "/proc/self/smaps" : "/proc/self/status", "r");
+  char line[256];
+  unsigned long start, end;
+  long kb = -1;
+  int in = addr == NULL;
+
+  if (f == NULL) return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (addr && sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      in = start == (unsigned long) addr;
+    } else if (in && sscanf(line, addr ? "Rss: %ld" : "VmRSS: %ld", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+static inline uint64_t
+random64(void)
+{
+  return (uint64_t) random() << 62 ^ (uint64_t) random() << 31 ^ random();
+}
+
+// Zipfian ranks in [0, n) with skew theta in (0, 1), after Gray et al.,
+// "Quickly generating billion-record synthetic databases".
+static struct {
+  long n;
+  double theta, alpha, zetan, eta;
+} zipf;
+
 static void
-print(void)
+zipf_init(long n, double theta)
+{
+  double zeta2 = 1 + pow(0.5, theta);
+  long i;
+
+  assert(theta > 0 && theta < 1);
+  zipf.n = n;
+  zipf.theta = theta;
+  zipf.alpha = 1 / (1 - theta);
+  zipf.zetan = 0;
+  for (i = 1; i <= n; i++) {
+    zipf.zetan += 1 / pow(i, theta);
+  }
+  zipf.eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf.zetan);
+}
+
+static long
+zipf_next(void)
+{
+  double u = random() / (RAND_MAX + 1.0);
+  double uz = u * zipf.zetan;
+  long r;
+
+  if (uz < 1) return 0;
+  if (uz < 1 + pow(0.5, zipf.theta)) return 1;
+  r = zipf.n * pow(zipf.eta * u - zipf.eta + 1, zipf.alpha);
+  return r < zipf.n ? r : zipf.n - 1;
+}
+
+// 16-byte keys, e.g. UUIDs
+struct uuid {
+  uint64_t hi;
+  uint64_t lo;
+};
+
+static inline struct uuid
+uuid_random(void)
 {
+  struct uuid u = { random64(), random64() };
+  return u;
+}
+
+static inline uint64_t
+uuid_hash(struct uuid u)
+{
+  return u.hi ^ (u.lo * 0x9e3779b97f4a7c15ULL);
+}
+
+static inline int
+uuid_eq(struct uuid a, struct uuid b)
+{
+  return a.hi == b.hi && a.lo == b.lo;
+}
+
+// Variable-length string keys. The bytes follow a length byte, and the
+// full hash is cached beside the pointer, so comparing two keys only
+// reaches the bytes when their hashes match.
+#define STR_MINLEN 8
+#define STR_MAXLEN 64
+
+struct str {
+  uint64_t hash;
+  const unsigned char *p;   // p[0] is the length, p[1..] the bytes
+};
+
+static inline uint64_t
+str_hashbytes(const unsigned char *s, int len)
+{
+  uint64_t h = len * 0x9e3779b97f4a7c15ULL, w;
   int i;
-  struct entry *e;
-  for (i = 0; i < NBUCKET; i++) {
-    printf("%d: ", i);
-    for (e = table[i]; e != 0; e = e->next) {
-      printf("%d ", e->key);
-    }
-    printf("\n");
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, s + i, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 29;
+  }
+  if (i < len) {
+    w = 0;
+    memcpy(&w, s + i, len - i);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
   }
+  h ^= h >> 32;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 29;
+  return h;
+}
+
+static inline struct str
+str_make(const unsigned char *p)
+{
+  struct str k = { str_hashbytes(p + 1, p[0]), p };
+  return k;
+}
+
+static inline int
+str_eq(struct str a, struct str b)
+{
+  return a.hash == b.hash && (a.p == b.p || memcmp(a.p, b.p, a.p[0] + 1) == 0);
 }
 
-static void 
-insert(int key, int value, struct entry **p, struct entry *n)
+// Keys shaped like cache and session keys: STR_MINLEN to STR_MAXLEN
+// bytes, a common prefix where it leaves room for 8 random characters.
+static struct str
+str_random(void)
 {
-  struct entry *e = malloc(sizeof(struct entry));
-  e->key = key;
-  e->value = value;
-  e->next = n;
-  *p = e;
+  static const char *prefix[] = { "user:", "session:", "cart:item:", "https://example.com/p/" };
+  static const char chars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_";
+  int len = STR_MINLEN + random() % (STR_MAXLEN - STR_MINLEN + 1);
+  const char *pre = prefix[random() % 4];
+  unsigned char *p = malloc(len + 1);
+  int i;
+
+  assert(p);
+  p[0] = len;
+  for (i = 0; len - i > 8 && pre[i]; i++) {
+    p[i + 1] = pre[i];
+  }
+  for (; i < len; i++) {
+    p[i + 1] = chars[random() & 63];
+  }
+  return str_make(p);
 }
 
-static 
-void put(int key, int value)
+// Interned key bytes. Each thread bump-allocates from chunks of its own,
+// so only taking a fresh chunk needs the lock; all chunks are freed at
+// once when the table that points into them is gone.
+#define ARENA_CHUNK (1 << 20)
+
+static struct arena_chunk {
+  struct arena_chunk *next;
+} *arena_chunks;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t arena_bytes, arena_used;
+static int arena_gen;
+static __thread unsigned char *arena_next, *arena_end;
+static __thread int arena_mygen;
+
+static const unsigned char *
+arena_copy(const unsigned char *s, size_t n)
 {
-  int i = key % NBUCKET;
-  pthread_mutex_lock(locks + i);
-  insert(key, value, &table[i], table[i]);
-  pthread_mutex_unlock(locks + i);
+  unsigned char *p;
+
+  if (arena_mygen != arena_gen || (size_t) (arena_end - arena_next) < n) {
+    struct arena_chunk *c = malloc(ARENA_CHUNK);
+    assert(c && n <= ARENA_CHUNK - sizeof(*c));
+    pthread_mutex_lock(&arena_lock);
+    c->next = arena_chunks;
+    arena_chunks = c;
+    arena_bytes += ARENA_CHUNK;
+    pthread_mutex_unlock(&arena_lock);
+    arena_mygen = arena_gen;
+    arena_next = (unsigned char *) (c + 1);
+    arena_end = (unsigned char *) c + ARENA_CHUNK;
+  }
+  p = arena_next;
+  memcpy(p, s, n);
+  arena_next += n;
+  __sync_fetch_and_add(&arena_used, n);
+  return p;
 }
 
-static struct entry*
-get(int key)
+// Free every chunk; no thread may be interning.
+static void
+arena_reset(void)
 {
-  /* no lock is required as every thread is done */
-  struct entry *e = 0;
-  for (e = table[key % NBUCKET]; e != 0; e = e->next) {
-    if (e->key == key) break;
+  struct arena_chunk *c, *next;
+
+  for (c = arena_chunks; c != NULL; c = next) {
+    next = c->next;
+    free(c);
   }
-  return e;
+  arena_chunks = NULL;
+  arena_bytes = arena_used = 0;
+  arena_gen++;  // strands every thread's current chunk
+}
+
+static inline struct str
+str_intern(struct str k)
+{
+  struct str c = { k.hash, arena_copy(k.p, k.p[0] + 1) };
+  return c;
+}
+
+// Key files (-K, -G): a header, then nkeys keys, then their values.
+// Both arrays start on a page boundary, so a mapping of the file serves
+// as the key and value arrays in place, and each thread only faults in
+// the pages it touches.
+#define KEYFILE_MAGIC 0x4b364857  // "WH6K"
+
+struct keyfile_header {
+  uint32_t magic;
+  uint16_t keysize;
+  uint16_t valuesize;
+  uint64_t nkeys;
+};
+
+static size_t
+keyfile_round(size_t n)
+{
+  return (n + 4095) & ~(size_t) 4095;
 }
 
+// The key count of the file at path.
+static long
+keyfile_nkeys(const char *path)
+{
+  struct keyfile_header h;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0 || read(fd, &h, sizeof(h)) != sizeof(h) || h.magic != KEYFILE_MAGIC) {
+    fprintf(stderr, "%s: not a key file\n", path);
+    exit(-1);
+  }
+  close(fd);
+  return h.nkeys;
+}
+
+// Map the file at path; returns its keys and sets *vals to its values.
 static void *
-thread(void *xa)
+keyfile_map(const char *path, int keysize, int valuesize, void **vals)
+{
+  struct keyfile_header h;
+  struct stat st;
+  size_t voff;
+  char *map;
+  int fd = open(path, O_RDONLY);
+
+  assert(fd >= 0 && fstat(fd, &st) == 0);
+  assert(read(fd, &h, sizeof(h)) == sizeof(h));
+  if (h.keysize != keysize || h.valuesize != valuesize) {
+    fprintf(stderr, "%s: holds %d-byte keys and %d-byte values\n", path, h.keysize, h.valuesize);
+    exit(-1);
+  }
+  voff = keyfile_round(4096 + h.nkeys * keysize);
+  assert((size_t) st.st_size >= voff + h.nkeys * valuesize);
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(map != MAP_FAILED);
+  close(fd);
+  *vals = map + voff;
+  return map + 4096;
+}
+
+// Fault in n bytes at p ahead of timing them; returns the seconds taken.
+static double
+keyfile_touch(const void *p, size_t n)
+{
+  const volatile char *c = p;
+  double t0 = now();
+  size_t i;
+
+  madvise((void *) ((uintptr_t) p & ~(uintptr_t) 4095), n + ((uintptr_t) p & 4095), MADV_WILLNEED);
+  for (i = 0; i < n; i += 4096) {
+    (void) c[i];
+  }
+  return now() - t0;
+}
+
+static void
+write_all(int fd, const void *p, size_t n)
+{
+  const char *c = p;
+  ssize_t w;
+
+  while (n > 0) {
+    w = write(fd, c, n);
+    assert(w > 0);
+    c += w;
+    n -= w;
+  }
+}
+
+// Write n keys and their values to a key file at path.
+static void
+keyfile_write(const char *path, const void *keys, int keysize, const void *vals,
+              int valuesize, long n)
+{
+  struct keyfile_header h = { KEYFILE_MAGIC, keysize, valuesize, n };
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  assert(fd >= 0);
+  assert(ftruncate(fd, keyfile_round(4096 + n * keysize) + n * valuesize) == 0);
+  write_all(fd, &h, sizeof(h));
+  assert(lseek(fd, 4096, SEEK_SET) == 4096);
+  write_all(fd, keys, n * keysize);
+  assert(lseek(fd, keyfile_round(4096 + n * keysize), SEEK_SET) >= 0);
+  write_all(fd, vals, n * valuesize);
+  close(fd);
+}
+
+// Every backend is instantiated per key type (hw6inst.h).
+
+// int keys and values: the original table
+#define KT_NAME itab
+#define KT_KEY int
+#define KT_VALUE int
+#define KT_HASH(k) ((uint64_t) (k))
+#define KT_EQ(a, b) ((a) == (b))
+#define KT_RANDOM() ((int) random())
+#define KT_VALUEOF(n) ((int) (n))
+#include "hw6inst.h"
+
+// 64-bit ids mapping to pointers
+#define KT_NAME ltab
+#define KT_KEY uint64_t
+#define KT_VALUE void *
+#define KT_HASH(k) (k)
+#define KT_EQ(a, b) ((a) == (b))
+#define KT_RANDOM() random64()
+#define KT_VALUEOF(n) ((void *) (n))
+#include "hw6inst.h"
+
+// UUIDs mapping to pointers
+#define KT_NAME utab
+#define KT_KEY struct uuid
+#define KT_VALUE void *
+#define KT_HASH(k) uuid_hash(k)
+#define KT_EQ(a, b) uuid_eq(a, b)
+#define KT_RANDOM() uuid_random()
+#define KT_VALUEOF(n) ((void *) (n))
+#include "hw6inst.h"
+
+// string keys, interned, mapping to pointers
+#define KT_NAME stab
+#define KT_KEY struct str
+#define KT_VALUE void *
+#define KT_HASH(k) ((k).hash)
+#define KT_EQ(a, b) str_eq(a, b)
+#define KT_RANDOM() str_random()
+#define KT_VALUEOF(n) ((void *) (n))
+#define KT_INTERN(k) str_intern(k)
+#define KT_RESET() arena_reset()
+#include "hw6inst.h"
+
+static struct backend {
+  const char *key;
+  const char *name;
+  void (*run)(struct bench *);
+} backends[] = {
+  BACKENDS(itab, "int32")
+  BACKENDS(ltab, "int64")
+  BACKENDS(utab, "uuid")
+  BACKENDS(stab, "str")
+};
+
+static void
+print(void)
 {
-  long n = (long) xa;
   int i;
-  int b = NKEYS/nthread;
-  int k = 0;
-  double t1, t0;
+  struct itab_entry *e;
+  for (i = 0; i < itab_tab.nbucket; i++) {
+    printf("%d: ", i);
+    for (e = itab_tab.table[i]; e != 0; e = e->next) {
+      printf("%d ", e->key);
+    }
+    printf("\n");
+  }
+}
 
-  //  printf("b = %d\n", b);
-  t0 = now();
-  for (i = 0; i < b; i++) {
-    // printf("%d: put %d\n", n, b*n+i);
-    put(keys[b*n + i], n);
+// Run the workload at 1, 2, 4, ... up to maxthread threads, plus the core
+// count, reps times each, and tabulate throughput, speedup over one
+// thread, parallel efficiency and the run-to-run coefficient of variation
+// (standard deviation as a percentage of the mean).
+static void
+sweep(void (*run)(struct bench *), int maxthread, int reps)
+{
+  int ncore = sysconf(_SC_NPROCESSORS_ONLN);
+  int counts[64], ncount = 0;
+  double base[2] = { 0, 0 };
+  struct bench r;
+  int i, j, p;
+
+  for (i = 1; i <= maxthread; i *= 2) {
+    counts[ncount++] = i;
+  }
+  if (ncore <= maxthread && (ncore & (ncore - 1)) != 0) {
+    for (i = ncount; i > 0 && counts[i-1] > ncore; i--) {
+      counts[i] = counts[i-1];
+    }
+    counts[i] = ncore;
+    ncount++;
   }
-  t1 = now();
-  printf("%ld: put time = %f\n", n, t1-t0);
 
-  // Should use pthread_barrier, but MacOS doesn't support it ...
-  __sync_fetch_and_add(&done, 1);
-  while (done < nthread) ;
+  quiet = 1;
+  printf("%7s %12s %7s %7s %5s %12s %7s %7s %5s\n", "threads",
+         "puts/s", "cv%", "speedup", "eff",
+         "gets/s", "cv%", "speedup", "eff");
+  for (i = 0; i < ncount; i++) {
+    double sum[2] = { 0, 0 }, sumsq[2] = { 0, 0 };
+    nthread = counts[i];
+    for (j = 0; j < reps; j++) {
+      double x[2];
+      run(&r);
+      x[0] = nkeys / r.put;
+      x[1] = (double) nkeys * nthread / r.get;
+      for (p = 0; p < 2; p++) {
+        sum[p] += x[p];
+        sumsq[p] += x[p] * x[p];
+      }
+    }
+    printf("%7d", nthread);
+    for (p = 0; p < 2; p++) {
+      double mean = sum[p] / reps;
+      double var = reps > 1 ? (sumsq[p] - reps * mean * mean) / (reps - 1) : 0;
+      if (i == 0) base[p] = mean;
+      printf(" %12.0f %6.1f%% %7.2f %4.0f%%", mean,
+             var > 0 ? 100 * sqrt(var) / mean : 0.0,
+             mean / base[p], 100 * mean / base[p] / nthread);
+    }
+    printf("\n");
+  }
+}
 
-  t0 = now();
-  for (i = 0; i < NKEYS; i++) {
-    struct entry *e = get(keys[i]);
-    if (e == 0) k++;
+// Run the workload without the write-ahead log, then with it at each
+// commit interval from 0 up to maxms, reps times each, and tabulate put
+// throughput, its coefficient of variation, the slowdown against no log
+// and the puts each commit carried.
+static void
+walsweep(void (*run)(struct bench *), double maxms, int reps)
+{
+  static const double ms[] = { 0, 0.1, 0.2, 0.5, 1, 2, 5, 10, 20, 50, 100 };
+  double base = 0;
+  struct bench r;
+  int i, j;
+
+  quiet = 1;
+  printf("%7s %12s %7s %7s %11s\n", "ms", "puts/s", "cv%", "vs off", "puts/commit");
+  for (i = -1; i < (int) (sizeof(ms) / sizeof(ms[0])) && (i < 0 || ms[i] <= maxms); i++) {
+    double sum = 0, sumsq = 0, mean, var;
+    long commits = 0;
+    walinterval = i < 0 ? -1 : ms[i] * 1000;
+    for (j = 0; j < reps; j++) {
+      double x;
+      run(&r);
+      x = nkeys / r.put;
+      sum += x;
+      sumsq += x * x;
+      commits += r.commits;
+    }
+    mean = sum / reps;
+    var = reps > 1 ? (sumsq - reps * mean * mean) / (reps - 1) : 0;
+    if (i < 0) {
+      base = mean;
+      printf("%7s", "off");
+    } else {
+      printf("%7g", ms[i]);
+    }
+    printf(" %12.0f %6.1f%% %6.3fx", mean, var > 0 ? 100 * sqrt(var) / mean : 0.0, mean / base);
+    if (i < 0) {
+      printf(" %11s\n", "-");
+    } else {
+      printf(" %11.1f\n", commits ? (double) nkeys * reps / commits : 0.0);
+    }
   }
-  t1 = now();
-  printf("%ld: get time = %f\n", n, t1-t0);
-  printf("%ld: %d keys missing\n", n, k);
-  return NULL;
+  unlink(walpath);
+}
+
+static void
+usage(char *prog)
+{
+  fprintf(stderr, "%s: %s [-k int32|int64|uuid|str] [-t chain|compact|robin|split|hopscotch|cache|shm] [-c] [-L lf] [-B] [-i K] [-f fpr] [-M] [-z theta] [-F] [-s reps] [-S] [-e] [-D] [-m] [-W ms] [-w path] [-C capacity] [-T ttl] [-R trace] [-r trace] [-p] [-K keyfile] [-G keyfile] [-H] [-U depth] [-P nproc] [-Z] [-J] [-A] [-X socket] [-Y socket] [-Q depth] [-d] [-n nkeys] [-b nbucket] nthread\n",
+          prog, prog);
+  exit(-1);
 }
 
 int
 main(int argc, char *argv[])
 {
-  pthread_t *tha;
-  void *value;
-  long i;
-  double t1, t0;
+  const char *key = "int32", *backend = "chain";
+  struct backend *be = NULL;
+  struct bench r;
+  double t1, t0, lf = 0;
+  int c, reps = 0;
+  size_t i;
 
-  if (argc < 2) {
-    fprintf(stderr, "%s: %s nthread\n", argv[0], argv[0]);
+  while ((c = getopt(argc, argv, "k:t:cL:Bi:f:Mz:Fs:SeDmW:w:C:T:R:r:pK:G:HU:P:ZJAX:Y:Q:dn:b:")) != -1) {
+    switch (c) {
+    case 'k':
+      key = optarg;
+      break;
+    case 't':
+      backend = optarg;
+      break;
+    case 'c':
+      backend = "compact";
+      break;
+    case 'L':
+      lf = atof(optarg);
+      break;
+    case 'B':
+      bulkload = 1;
+      break;
+    case 'i':
+      interleave = atoi(optarg);
+      break;
+    case 'f':
+      bloomfpr = atof(optarg);
+      break;
+    case 'M':
+      missphase = 1;
+      break;
+    case 'z':
+      zipftheta = atof(optarg);
+      break;
+    case 'F':
+      combining = 1;
+      break;
+    case 's':
+      reps = atoi(optarg);
+      break;
+    case 'S':
+      stats = 1;
+      break;
+    case 'e':
+      snapshot = 1;
+      break;
+    case 'D':
+      delegate = 1;
+      break;
+    case 'm':
+      cachemisses = 1;
+      break;
+    case 'W':
+      walinterval = atof(optarg) * 1000;
+      break;
+    case 'w':
+      walpath = optarg;
+      break;
+    case 'C':
+      capacity = atol(optarg);
+      break;
+    case 'T':
+      ttl = atol(optarg);
+      break;
+    case 'R':
+      recordpath = optarg;
+      break;
+    case 'r':
+      replaypath = optarg;
+      break;
+    case 'p':
+      paced = 1;
+      break;
+    case 'K':
+      keypath = optarg;
+      break;
+    case 'G':
+      genpath = optarg;
+      break;
+    case 'H':
+      hashbench = 1;
+      break;
+    case 'U':
+      uringdepth = atol(optarg);
+      break;
+    case 'P':
+      nproc = atoi(optarg);
+      break;
+    case 'Z':
+      freeze = 1;
+      break;
+    case 'J':
+      hashjoin = 1;
+      break;
+    case 'A':
+      aggregate = 1;
+      break;
+    case 'X':
+      servepath = optarg;
+      break;
+    case 'Y':
+      loadpath = optarg;
+      break;
+    case 'Q':
+      pipeline = atol(optarg);
+      break;
+    case 'd':
+      deletes = 1;
+      break;
+    case 'n':
+      nkeys = atoi(optarg);
+      break;
+    case 'b':
+      nbucket = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc) usage(argv[0]);
+  nthread = atoi(argv[optind]);
+  for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+    if (strcmp(key, backends[i].key) == 0 && strcmp(backend, backends[i].name) == 0)
+      be = &backends[i];
+  }
+  if (be == NULL) usage(argv[0]);
+  if (keypath) {
+    long n = keyfile_nkeys(keypath);
+    assert(n <= INT32_MAX);
+    nkeys = n;
+  }
+  // -L sizes the table for a target load factor: keys per bucket or slot
+  if (lf > 0) nbucket = nkeys / lf;
+  assert(nthread > 0 && nkeys > 0 && nbucket > 0);
+  // open addressing holds at most one key per slot
+  if (strcmp(backend, "robin") == 0 && nbucket < nkeys) {
+    fprintf(stderr, "-t robin needs at least as many buckets as keys (-b or -L)\n");
     exit(-1);
   }
-  for (size_t i = 0; i < NBUCKET; i++) {
-    pthread_mutex_init(locks + i, NULL);
+  // owners insert without the bucket locks that these rely on
+  if (delegate && (interleave > 0 || combining || snapshot)) {
+    fprintf(stderr, "-D does not combine with -i, -F or -e\n");
+    exit(-1);
   }
-  nthread = atoi(argv[1]);
-  tha = malloc(sizeof(pthread_t) * nthread);
-  srandom(0);
-  assert(NKEYS % nthread == 0);
-  for (i = 0; i < NKEYS; i++) {
-    keys[i] = random();
+  // the log holds key bytes, and only put() writes it
+  if (walinterval >= 0 && (bulkload || delegate || strcmp(key, "str") == 0)) {
+    fprintf(stderr, "-W does not combine with -B, -D or -k str\n");
+    exit(-1);
   }
-  t0 = now();
-  for(i = 0; i < nthread; i++) {
-    assert(pthread_create(&tha[i], NULL, thread, (void *) i) == 0);
+  // traces hold key bytes, and record only the plain put and get loops
+  if ((recordpath || replaypath) &&
+      (bulkload || interleave > 0 || delegate || strcmp(key, "str") == 0)) {
+    fprintf(stderr, "-R and -r do not combine with -B, -i, -D or -k str\n");
+    exit(-1);
   }
-  for(i = 0; i < nthread; i++) {
-    assert(pthread_join(tha[i], &value) == 0);
+  if (replaypath && (reps > 0 || freeze || deletes)) {
+    fprintf(stderr, "-r does not combine with -s, -Z or -d\n");
+    exit(-1);
   }
+  // ring workers only put and get
+  if (uringdepth > 0 && (interleave > 0 || delegate || walinterval >= 0 || recordpath || replaypath)) {
+    fprintf(stderr, "-U does not combine with -i, -D, -W, -R or -r\n");
+    exit(-1);
+  }
+  // other processes can't follow pointers into this one
+  if (strcmp(backend, "shm") == 0 && strcmp(key, "str") == 0) {
+    fprintf(stderr, "-t shm does not combine with -k str\n");
+    exit(-1);
+  }
+  // key files hold key bytes, in their own order
+  if ((keypath || genpath) && (zipftheta > 0 || strcmp(key, "str") == 0)) {
+    fprintf(stderr, "-K and -G do not combine with -z or -k str\n");
+    exit(-1);
+  }
+  if (genpath && (keypath || replaypath || reps > 0)) {
+    fprintf(stderr, "-G does not combine with -K, -r or -s\n");
+    exit(-1);
+  }
+
+  // the joins replace the workload
+  if (hashjoin && (reps > 0 || replaypath || genpath || delegate || walinterval >= 0 ||
+                   recordpath || uringdepth > 0)) {
+    fprintf(stderr, "-J does not combine with -s, -r, -G, -D, -W, -R or -U\n");
+    exit(-1);
+  }
+  // so does the aggregation
+  if (aggregate && (reps > 0 || replaypath || genpath || delegate || walinterval >= 0 ||
+                    recordpath || uringdepth > 0 || hashjoin)) {
+    fprintf(stderr, "-A does not combine with -s, -r, -G, -D, -W, -R, -U or -J\n");
+    exit(-1);
+  }
+  // and serving or loading a server
+  if ((servepath || loadpath) && (reps > 0 || replaypath || genpath || delegate ||
+                                  walinterval >= 0 || recordpath || uringdepth > 0 ||
+                                  hashjoin || aggregate || deletes || (servepath && loadpath))) {
+    fprintf(stderr, "-X and -Y do not combine with each other, -s, -r, -G, -D, -W, -R, -U, -J, -A or -d\n");
+    exit(-1);
+  }
+  // requests hold key bytes
+  if ((servepath || loadpath) && strcmp(key, "str") == 0) {
+    fprintf(stderr, "-X and -Y do not combine with -k str\n");
+    exit(-1);
+  }
+  assert(pipeline > 0);
+
+  if (reps > 0 && walinterval >= 0) {
+    walsweep(be->run, walinterval / 1000.0, reps);
+    return 0;
+  }
+  if (reps > 0) {
+    sweep(be->run, nthread, reps);
+    return 0;
+  }
+
+  t0 = now();
+  be->run(&r);
   t1 = now();
+  if (arena_bytes > 0) {
+    printf("key arena: %zu bytes in chunks, %.1f bytes/key used\n",
+           arena_bytes, (double) arena_used / nkeys);
+  }
   printf("completion time = %f\n", t1-t0);
+  return 0;
 }
@@ -0,0 +1,82 @@
+// Per-thread pre-aggregation in front of a chained table (hw6table.h)
+// used for group-by: include right after it, with the same HT_
+// parameters.
+//
+// A thread adds to keys through its own HT_(agglocal), a small
+// open-addressing table that no other thread sees, so repeated keys are
+// summed in cache without atomics. Once it holds AGG_FILL keys, keys not
+// already in it go straight to the shared table with HT_(accumulate);
+// under skew the hot keys turn up early and stay private. At the end the
+// thread merges it into the shared table, one atomic add per key it
+// held. With few repeats it costs a probe per key over accumulating
+// straight into the shared table.
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef HW6AGG_H
+#define HW6AGG_H
+
+#define AGG_SLOTS 8192        // slots of a private table
+#define AGG_FILL 4096         // keys it holds, at most half full
+
+#endif
+
+struct HT_(aggslot) {
+  HT_KEY key;
+  HT_VALUE sum;
+};
+
+struct HT_(agglocal) {
+  struct HT_NAME *t;
+  int n;                      // keys held
+  long direct;                // keys accumulated straight, once full
+  unsigned char used[AGG_SLOTS];
+  struct HT_(aggslot) slot[AGG_SLOTS];
+};
+
+static void
+HT_(agg_init)(struct HT_(agglocal) *a, struct HT_NAME *t)
+{
+  a->t = t;
+  a->n = 0;
+  a->direct = 0;
+  memset(a->used, 0, sizeof(a->used));
+}
+
+// Accumulate a's sums into its shared table and empty it.
+static void
+HT_(agg_merge)(struct HT_(agglocal) *a)
+{
+  int i;
+
+  if (a->n == 0) return;
+  for (i = 0; i < AGG_SLOTS; i++) {
+    if (a->used[i]) HT_(accumulate)(a->t, a->slot[i].key, a->slot[i].sum);
+  }
+  a->n = 0;
+  memset(a->used, 0, sizeof(a->used));
+}
+
+static inline void
+HT_(agg_add)(struct HT_(agglocal) *a, HT_KEY key, HT_VALUE delta)
+{
+  uint32_t i = bloom_mix(HT_HASH(key)) & (AGG_SLOTS - 1);
+
+  for (; a->used[i]; i = (i + 1) & (AGG_SLOTS - 1)) {
+    if (HT_EQ(a->slot[i].key, key)) {
+      a->slot[i].sum = (HT_VALUE) ((uintptr_t) a->slot[i].sum + (uintptr_t) delta);
+      return;
+    }
+  }
+  if (a->n == AGG_FILL) {
+    HT_(accumulate)(a->t, key, delta);
+    a->direct++;
+    return;
+  }
+  a->used[i] = 1;
+  a->slot[i].key = key;
+  a->slot[i].sum = delta;
+  a->n++;
+}
@@ -0,0 +1,39 @@
+// One backend of hw6inst.h: the table header HT_BACKEND, instantiated
+// for the key type KT_*, with everything that works over it and its
+// benchmark. Define HT_NAME and HT_BACKEND, and any backend options such
+// as HT_COMPACT, before including.
+//
+// Every backend gets the write-ahead log of hw6wal.h, the traces of
+// hw6trace.h, the request rings of hw6ring.h and the socket server of
+// hw6serve.h. The chained table (HT_CHAINED) also gets the delegation of
+// hw6shard.h, the frozen copies of hw6freeze.h, the joins of hw6join.h
+// and the pre-aggregation of hw6agg.h. The first backend of a key type
+// draws the keys, and the rest share them.
+
+#define HT_KEY KT_KEY
+#define HT_VALUE KT_VALUE
+#define HT_HASH(k) KT_HASH(k)
+#define HT_EQ(a, b) KT_EQ(a, b)
+#define HT_INTERN(k) KT_INTERN(k)
+#define BENCH_KEY() KT_RANDOM()
+#define BENCH_VALUE(n) KT_VALUEOF(n)
+#define BENCH_RESET() KT_RESET()
+#ifdef KT_KEYS
+#define BENCH_KEYS KT_KEYS
+#endif
+#include HT_BACKEND
+#include "hw6wal.h"
+#include "hw6trace.h"
+#include "hw6ring.h"
+#include "hw6serve.h"
+#ifdef HT_CHAINED
+#include "hw6shard.h"
+#include "hw6freeze.h"
+#include "hw6join.h"
+#include "hw6agg.h"
+#endif
+#include "hw6bench.h"
+#undef HT_BACKEND
+
+// the key array of hw6bench.h's first instantiation for this key type
+#define KT_KEYS HT_CAT(KT_NAME, _keys)
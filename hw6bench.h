@@ -0,0 +1,1058 @@
+// Put/get benchmark over one hw6 table instantiation (hw6table.h or
+// another backend with the same interface).
+//
+// Include right after the table header, hw6wal.h, hw6trace.h, hw6ring.h
+// and hw6serve.h, with the same HT_ parameters plus:
+//   BENCH_KEY()      expression yielding a fresh random key
+//   BENCH_VALUE(n)   value stored by thread n
+// and optionally BENCH_KEYS, the name of a key array to share with an
+// earlier instantiation of the same key type, and BENCH_RESET(), called
+// when the previous run's table is destroyed to free what HT_INTERN kept.
+//
+// Generates HT_(run)(struct bench *), which is the original hw6 workload:
+// every thread puts its slice of the keys, then looks up all of them.
+// The options in hw6.c's globals adjust it:
+//   bulkload     the put phase is one HT_(bulk_load) of all keys
+//   interleave   K > 0 makes the get phase use HT_(get_batch)
+//   bloomfpr     > 0 gives the table a Bloom filter with that rate
+//   missphase    adds a phase looking up nkeys fresh, nearly all absent,
+//                random keys
+//   zipftheta    > 0 draws the keys from nkeys distinct ones with
+//                Zipfian popularity
+//   combining    switches put() to flat combining
+//   stats        prints HT_(stats) of the table after the run
+//   snapshot     keeps taking HT_(for_each) snapshots during the puts
+//   delegate     runs every phase through HT_(deleg_run), each thread
+//                owning a shard (hw6shard.h)
+//   cachemisses  counts each thread's cache misses per phase
+//   walinterval  >= 0 logs the puts to walpath (hw6wal.h) with that
+//                commit interval, then times recovery from the log
+//   capacity     > 0 bounds the cache backend (HT_CACHE) to that many
+//                entries, and ttl > 0 expires them after ttl ms; a cache
+//                get phase puts every key it misses, and reports its
+//                hit ratio
+//   recordpath   records every put and get to a trace there
+//   replaypath   replaces the workload with replaying the trace there,
+//                paced by its times if paced is set
+//   keypath      maps the keys and values from the key file there
+//                instead of drawing them; each thread faults in its
+//                slice before timing its puts
+//   genpath      only draws the keys and writes them, with the values
+//                thread n of nthread would put, to a key file there
+//   hashbench    first times hashing the keys to buckets one at a time
+//                and with the batch kernels of hw6hash.h
+//   uringdepth   > 0 sends every phase's requests through the rings of
+//                hw6ring.h with up to that many in flight per thread,
+//                to a pool of nthread more worker threads
+//   nproc        > 0 then forks that many processes, which attach to
+//                the shared-memory table (HT_SHM) and look up every key
+//   freeze       then freezes the table (hw6freeze.h) on nthread threads
+//                and has every thread look up all keys in the frozen copy
+//   hashjoin     replaces the workload with joins (hw6join.h) of the
+//                first nkeys/16, nkeys/4 and nkeys keys with as many drawn
+//                from them, without partitioning and radix partitioned
+//   aggregate    replaces the workload with counting the keys per key,
+//                with HT_(accumulate) straight into a shared table and
+//                then through per-thread pre-aggregation (hw6agg.h)
+//   servepath    replaces the workload with serving a fresh table on a
+//                Unix socket there (hw6serve.h) with nthread threads,
+//                until SIGINT or SIGTERM; a table that can't grow takes
+//                at most nkeys puts
+//   loadpath     replaces the workload with running it against the
+//                server there instead, from nthread connections with up
+//                to pipeline requests in flight each
+//   deletes      then, on nthread threads, deletes the keys whose hash is
+//                odd, checks that the table holds just the rest, deletes
+//                those too and checks that every slot is empty
+//   quiet        suppresses all output
+// Only the chained table (HT_CHAINED) has bulk load, batches, filters,
+// combining, stats, snapshots, freezing, joins and aggregation; only
+// with hw6shard.h (HT_DELEGATE) can it delegate. Only the Robin Hood
+// table (HT_ROBIN) deletes.
+// The shared-memory table's segment is unnamed at the end of the run.
+// All HT_ and BENCH_ parameters are #undef'd at the end.
+
+#ifndef BENCH_BATCH
+#define BENCH_BATCH 1024  // keys per get_batch call
+#endif
+
+#ifdef BENCH_KEYS
+#define BENCH_KEYV BENCH_KEYS
+#else
+#define BENCH_KEYV HT_(keys)
+static HT_KEY *BENCH_KEYV;
+#endif
+static HT_KEY *HT_(misskeys);
+static HT_VALUE *HT_(vals);   // from the key file, or NULL
+static struct HT_NAME HT_(tab);
+static int HT_(live);
+static volatile int HT_(done);
+static struct spinbarrier HT_(bar);
+static struct bench *HT_(res);
+static struct wal *HT_(wal);
+static struct trace *HT_(tr);
+static struct HT_(uring) HT_(ur);
+#ifdef HT_DELEGATE
+static struct HT_(deleg) HT_(dg);
+#endif
+
+// The value the put of key i by thread n stores.
+static inline HT_VALUE
+HT_(valueat)(long i, long n)
+{
+  return HT_(vals) ? HT_(vals)[i] : BENCH_VALUE(n);
+}
+
+static void *
+HT_(thread)(void *xa)
+{
+  long n = (long) xa;
+  int i;
+  int lo = (long) nkeys * n / nthread;
+  int hi = (long) nkeys * (n + 1) / nthread;
+  int k = 0;
+  int fd = cachemisses ? perf_open() : -1;
+  HT_VALUE *vals = NULL;      // this slice's values, for -D and -U
+  long c0;
+  double t1, t0;
+
+  if (keypath) {
+    t0 = keyfile_touch(BENCH_KEYV + lo, sizeof(HT_KEY) * (hi - lo));
+    if (HT_(vals)) t0 += keyfile_touch(HT_(vals) + lo, sizeof(HT_VALUE) * (hi - lo));
+    if (!quiet) printf("%ld: key fault-in time = %f\n", n, t0);
+  }
+  if (!bulkload) {
+    if (delegate || uringdepth > 0) {
+      vals = malloc(sizeof(HT_VALUE) * (hi - lo + 1));
+      assert(vals);
+      for (i = lo; i < hi; i++) {
+        vals[i - lo] = HT_(valueat)(i, n);
+      }
+    }
+    t0 = spinbarrier_wait(&HT_(bar), nthread);
+    c0 = perf_read(fd);
+#ifdef HT_DELEGATE
+    if (delegate) {
+      HT_(deleg_run)(&HT_(dg), n, SHARD_PUT, BENCH_KEYV + lo, vals, hi - lo);
+    } else
+#endif
+    if (uringdepth > 0) {
+      HT_(uring_run)(&HT_(ur), n, RING_PUT, BENCH_KEYV + lo, vals, hi - lo);
+    } else
+    for (i = lo; i < hi; i++) {
+      if (HT_(tr)) HT_(trace)(HT_(tr), n, TRACE_PUT, BENCH_KEYV[i], HT_(valueat)(i, n));
+      if (HT_(wal)) HT_(wal_put)(&HT_(tab), HT_(wal), n, BENCH_KEYV[i], HT_(valueat)(i, n));
+      else HT_(put)(&HT_(tab), BENCH_KEYV[i], HT_(valueat)(i, n));
+    }
+    t1 = now();
+    HT_(res)[n].put = t1-t0;
+    HT_(res)[n].putcache = perf_since(fd, c0);
+    if (!quiet) printf("%ld: put time = %f\n", n, t1-t0);
+  }
+
+  __sync_fetch_and_add(&HT_(done), 1);  // for HT_(snapshots)
+  if (HT_(tr)) trace_phase(HT_(tr), n);
+  t0 = spinbarrier_wait(&HT_(bar), nthread);
+  c0 = perf_read(fd);
+#ifdef HT_DELEGATE
+  if (delegate) {
+    k = HT_(deleg_run)(&HT_(dg), n, SHARD_GET, BENCH_KEYV, NULL, nkeys);
+  } else
+#endif
+  if (uringdepth > 0) {
+    k = HT_(uring_run)(&HT_(ur), n, RING_GET, BENCH_KEYV, NULL, nkeys);
+  } else
+#ifdef HT_CHAINED
+  if (interleave > 0) {
+    struct HT_(entry) *e[BENCH_BATCH];
+    int j, m;
+    for (i = 0; i < nkeys; i += m) {
+      m = nkeys - i < BENCH_BATCH ? nkeys - i : BENCH_BATCH;
+      HT_(get_batch)(&HT_(tab), BENCH_KEYV + i, m, interleave, e);
+      for (j = 0; j < m; j++) {
+        if (e[j] == 0) k++;
+      }
+    }
+  } else
+#endif
+  {
+    for (i = 0; i < nkeys; i++) {
+      struct HT_(entry) *e;
+      if (HT_(tr)) HT_(trace)(HT_(tr), n, TRACE_GET, BENCH_KEYV[i], (HT_VALUE) 0);
+      e = HT_(get)(&HT_(tab), BENCH_KEYV[i]);
+      if (e == 0) k++;
+#ifdef HT_CACHE
+      if (e == 0) {
+        if (HT_(tr)) HT_(trace)(HT_(tr), n, TRACE_PUT, BENCH_KEYV[i], HT_(valueat)(i, n));
+        HT_(put)(&HT_(tab), BENCH_KEYV[i], HT_(valueat)(i, n));
+      }
+#endif
+    }
+  }
+  t1 = now();
+  HT_(res)[n].get = t1-t0;
+  HT_(res)[n].getcache = perf_since(fd, c0);
+  HT_(res)[n].missing = k;
+  if (!quiet) {
+    printf("%ld: get time = %f\n", n, t1-t0);
+    printf("%ld: %d keys missing\n", n, k);
+  }
+
+  if (missphase) {
+    k = 0;
+    if (HT_(tr)) trace_phase(HT_(tr), n);
+    t0 = spinbarrier_wait(&HT_(bar), nthread);
+#ifdef HT_DELEGATE
+    if (delegate) {
+      k = nkeys - HT_(deleg_run)(&HT_(dg), n, SHARD_GET, HT_(misskeys), NULL, nkeys);
+    } else
+#endif
+    if (uringdepth > 0) {
+      k = nkeys - HT_(uring_run)(&HT_(ur), n, RING_GET, HT_(misskeys), NULL, nkeys);
+    } else
+    for (i = 0; i < nkeys; i++) {
+      if (HT_(tr)) HT_(trace)(HT_(tr), n, TRACE_GET, HT_(misskeys)[i], (HT_VALUE) 0);
+      if (HT_(get)(&HT_(tab), HT_(misskeys)[i]) != 0) k++;
+    }
+    t1 = now();
+    HT_(res)[n].miss = t1-t0;
+    HT_(res)[n].found = k;
+    if (!quiet) printf("%ld: miss time = %f\n", n, t1-t0);
+  }
+  if (fd >= 0) close(fd);
+  free(vals);
+  return NULL;
+}
+
+// Entries a table for n puts must have room for.
+static long
+HT_(nentry)(long n)
+{
+#ifdef HT_CACHE
+  if (capacity > 0) return capacity;
+#endif
+#ifdef HT_CHAINED
+  return n + (long) nthread * HT_POOLCHUNK;
+#else
+  return n;
+#endif
+}
+
+#ifdef HT_CHAINED
+static void
+HT_(counteach)(HT_KEY key, HT_VALUE value, int thread, void *arg)
+{
+  (void) key;
+  (void) value;
+  ((long *) arg)[thread * 8]++;  // a cache line per thread
+}
+
+// Snapshot the table over and over until the put phase is done; at least
+// once, in case it already is.
+static void
+HT_(snapshots)(void)
+{
+  long *seen = malloc(sizeof(long) * 8 * nthread);
+  long nseen, sum = 0;
+  double t1, t0, total = 0;
+  int i, nsnap = 0;
+
+  assert(seen);
+  do {
+    memset(seen, 0, sizeof(long) * 8 * nthread);
+    t0 = now();
+    HT_(for_each)(&HT_(tab), nthread, HT_(counteach), seen);
+    t1 = now();
+    total += t1-t0;
+    nsnap++;
+    for (nseen = 0, i = 0; i < nthread; i++) {
+      nseen += seen[i * 8];
+    }
+    sum += nseen;
+    if (!quiet) printf("snapshot %d: %ld keys, time = %f\n", nsnap, nseen, t1-t0);
+  } while (HT_(done) < nthread);
+  if (!quiet) {
+    printf("snapshot throughput = %.0f keys/s over %d snapshots\n",
+           sum / total, nsnap);
+  }
+  free(seen);
+}
+
+static struct HT_(frozen) *HT_(frz);
+
+// Look up every key in the frozen copy; res gets the time taken and the
+// keys missing.
+static void *
+HT_(frozenthread)(void *xa)
+{
+  double *res = xa, t0 = now();
+  long i, k = 0;
+
+  for (i = 0; i < nkeys; i++) {
+    if (HT_(frozen_get)(HT_(frz), BENCH_KEYV[i]) == 0) k++;
+  }
+  res[0] = now() - t0;
+  res[1] = k;
+  return NULL;
+}
+
+// Freeze the table on nthread threads, then have each look up every key
+// in the frozen copy, and compare with the get phase of r.
+static void
+HT_(frozenrun)(struct bench *r)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthread);
+  double *res = malloc(sizeof(double) * 2 * nthread), t1, t0, get = 0;
+  long missing = 0;
+  void *value;
+  int i;
+
+  assert(tha && res);
+  t0 = now();
+  HT_(frz) = HT_(freeze)(&HT_(tab), nthread);
+  t1 = now();
+  printf("freeze: %ld keys, time = %f, %.0f keys/s, %.1f bytes/key\n", HT_(frz)->n,
+         t1-t0, HT_(frz)->n / (t1-t0), (double) HT_(frozen_bytes)(HT_(frz)) / HT_(frz)->n);
+  for (i = 0; i < nthread; i++) {
+    assert(pthread_create(&tha[i], NULL, HT_(frozenthread), res + 2 * i) == 0);
+  }
+  for (i = 0; i < nthread; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+    if (res[2 * i] > get) get = res[2 * i];
+    missing += res[2 * i + 1];
+  }
+  printf("frozen get throughput = %.0f lookups/s, %.1f ns/lookup, %.2fx the table's, "
+         "%ld keys missing\n", (double) nkeys * nthread / get, 1e9 * get / nkeys,
+         r->get / get, missing);
+  HT_(frozen_free)(HT_(frz));
+  HT_(frz) = NULL;
+  free(tha);
+  free(res);
+}
+
+// Join R, the first n keys, with S, n keys drawn from R, both ways, for n
+// of nkeys/16, nkeys/4 and nkeys, and report tuples of R and S joined per
+// second. Each tuple's value is its index.
+static void
+HT_(joinrun)(struct bench *r)
+{
+  struct HT_(joinout) *out = calloc(nthread, sizeof(*out));
+  HT_KEY *sk = malloc(sizeof(HT_KEY) * nkeys);
+  HT_VALUE *rv = malloc(sizeof(HT_VALUE) * nkeys);
+  HT_VALUE *sv = malloc(sizeof(HT_VALUE) * nkeys);
+  double time[2];
+  long sizes[3] = { nkeys / 16, nkeys / 4, nkeys };
+  long n, i, m[2];
+  int bits, k, pass, z;
+
+  assert(out && sk && rv && sv);
+  for (i = 0; i < nkeys; i++) {
+    rv[i] = sv[i] = (HT_VALUE) i;
+  }
+  memset(r, 0, sizeof(*r));
+  for (z = 0; z < 3; z++) {
+    n = sizes[z];
+    // small nkeys round the fractions to 0 or to the next size
+    if (n == 0 || (z < 2 && n == sizes[z+1])) continue;
+    srandom(3);
+    for (i = 0; i < n; i++) {
+      sk[i] = BENCH_KEYV[random() % n];
+    }
+    // S matches at least once, and about n more, so room for 2n + slack
+    for (k = 0; k < nthread; k++) {
+      HT_(joinout_reserve)(&out[k], 2 * n / nthread + 1024);
+    }
+    bits = join_bits(n);
+    for (pass = 0; pass < 2; pass++) {
+      for (k = 0; k < nthread; k++) {
+        out[k].n = 0;
+      }
+      m[pass] = HT_(join)(BENCH_KEYV, rv, n, sk, sv, n, nthread, pass ? bits : 0, out, time);
+      // the table's entries go back to malloc as fast-bin chunks, which
+      // the next large allocation would otherwise consolidate on the clock
+      malloc_trim(0);
+      if (quiet) continue;
+      printf("join: %ld x %ld, %-20s %s time = %f, %s time = %f, %.0f tuples/s, %ld matches\n",
+             n, n, pass ? "radix partitioned," : "no partitioning,", pass ? "partition" : "build",
+             time[0], pass ? "join" : "probe", time[1], 2.0 * n / (time[0] + time[1]), m[pass]);
+    }
+    assert(m[0] == m[1]);
+    if (!quiet) printf("join: radix partitions = %d, %.0f R tuples each\n", 1 << bits, (double) n / (1 << bits));
+  }
+  for (k = 0; k < nthread; k++) {
+    free(out[k].m);
+  }
+  free(out);
+  free(sk);
+  free(rv);
+  free(sv);
+}
+
+struct HT_(aggarg) {
+  struct HT_NAME *t;
+  long n;
+  int private;
+  double time;
+  long shared;                // accumulates the shared table saw
+};
+
+// Count thread n's slice of the keys into the table, straight or through
+// a private table.
+static void *
+HT_(aggthread)(void *xa)
+{
+  struct HT_(aggarg) *a = xa;
+  long lo = (long) nkeys * a->n / nthread;
+  long hi = (long) nkeys * (a->n + 1) / nthread;
+  struct HT_(agglocal) *al = NULL;
+  double t0 = now();
+  long i;
+
+  if (a->private) {
+    al = malloc(sizeof(*al));
+    assert(al);
+    HT_(agg_init)(al, a->t);
+    for (i = lo; i < hi; i++) {
+      HT_(agg_add)(al, BENCH_KEYV[i], (HT_VALUE) 1);
+    }
+    a->shared = al->direct + al->n;
+    HT_(agg_merge)(al);
+    free(al);
+  } else {
+    for (i = lo; i < hi; i++) {
+      HT_(accumulate)(a->t, BENCH_KEYV[i], (HT_VALUE) 1);
+    }
+  }
+  a->time = now() - t0;
+  return NULL;
+}
+
+static void
+HT_(sumeach)(HT_KEY key, HT_VALUE value, int thread, void *arg)
+{
+  (void) key;
+  ((long *) arg)[thread * 16] += (uintptr_t) value;
+  ((long *) arg)[thread * 16 + 8]++;
+}
+
+// Count the keys per key with nthread threads, first accumulating each
+// straight into a shared table, then through per-thread pre-aggregation,
+// and check both counts add up.
+static void
+HT_(aggrun)(struct bench *r)
+{
+  static const char *name[] = { "shared", "private" };
+  struct HT_(aggarg) *a = calloc(nthread, sizeof(*a));
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthread);
+  long *sums = malloc(sizeof(long) * 16 * nthread);
+  long sum, groups, shared;
+  double time;
+  void *value;
+  int p, i;
+
+  assert(a && tha && sums);
+  memset(r, 0, sizeof(*r));
+  for (p = 0; p < 2; p++) {
+    struct HT_NAME t;
+
+    HT_(init)(&t, nbucket, HT_(nentry)(nkeys));
+    for (i = 0; i < nthread; i++) {
+      a[i].t = &t;
+      a[i].n = i;
+      a[i].private = p;
+      assert(pthread_create(&tha[i], NULL, HT_(aggthread), &a[i]) == 0);
+    }
+    time = shared = 0;
+    for (i = 0; i < nthread; i++) {
+      assert(pthread_join(tha[i], &value) == 0);
+      if (a[i].time > time) time = a[i].time;
+      shared += a[i].shared;
+    }
+    memset(sums, 0, sizeof(long) * 16 * nthread);
+    HT_(for_each)(&t, nthread, HT_(sumeach), sums);
+    for (sum = groups = 0, i = 0; i < nthread; i++) {
+      sum += sums[i * 16];
+      groups += sums[i * 16 + 8];
+    }
+    assert(sum == nkeys);
+    if (p == 0) r->put = time;
+    else r->get = time;
+    if (!quiet) {
+      printf("aggregate: %-7s %ld groups, time = %f, %.0f keys/s", name[p], groups, time,
+             nkeys / time);
+      if (p == 1) {
+        printf(", %.1f%% of keys reached the shared table", 100.0 * shared / nkeys);
+      }
+      printf("\n");
+    }
+    HT_(destroy)(&t);
+#ifdef BENCH_RESET
+    BENCH_RESET();
+#endif
+    malloc_trim(0);       // as in HT_(joinrun)
+  }
+  free(a);
+  free(tha);
+  free(sums);
+}
+#endif
+
+// Replay the log into a second table on nthread threads, check that it
+// holds every key, and remove the log.
+static void
+HT_(recover)(void)
+{
+  struct HT_NAME rt;
+  long nrec, k = 0, i;
+  double t1, t0;
+
+  HT_(init)(&rt, nbucket, HT_(nentry)(nkeys));
+  t0 = now();
+  nrec = HT_(wal_recover)(&rt, walpath, nthread);
+  t1 = now();
+  for (i = 0; i < nkeys; i++) {
+    if (HT_(get)(&rt, BENCH_KEYV[i]) == 0) k++;
+  }
+  printf("recovery: %ld records, time = %f, %.0f records/s, %ld keys missing\n",
+         nrec, t1-t0, nrec / (t1-t0), k);
+  HT_(destroy)(&rt);
+  unlink(walpath);
+}
+
+// Hash every key to its bucket, one at a time with % NBUCKET and
+// % nbucket, then HASH_CHUNK at a time with each batch kernel, and print
+// the best of three passes in cycles per key.
+static void
+HT_(hashbench)(void)
+{
+  static const char *name[] = { "% NBUCKET", "% nbucket", "batch, scalar", "batch, avx2" };
+  uint32_t *a = malloc(sizeof(uint32_t) * nkeys);
+  uint32_t *b = malloc(sizeof(uint32_t) * nkeys);
+  uint64_t h[HASH_CHUNK], c0;
+  double best, c;
+  long i;
+  int v, pass, j, m;
+
+  assert(a && b);
+  memset(a, 0, sizeof(uint32_t) * nkeys);
+  memset(b, 0, sizeof(uint32_t) * nkeys);
+  for (v = 0; v < 4; v++) {
+    if (v == 3 && !hash_avx2()) {
+      printf("hash: %-14s no AVX2\n", name[v]);
+      continue;
+    }
+    best = 0;
+    for (pass = 0; pass < 2; pass++) {
+      c0 = cycles();
+      if (v == 0) {
+        for (i = 0; i < nkeys; i++) {
+          b[i] = HT_HASH(BENCH_KEYV[i]) % NBUCKET;
+        }
+      } else if (v == 1) {
+        for (i = 0; i < nkeys; i++) {
+          a[i] = HT_HASH(BENCH_KEYV[i]) % nbucket;
+        }
+      } else {
+        for (i = 0; i < nkeys; i += m) {
+          m = nkeys - i < HASH_CHUNK ? nkeys - i : HASH_CHUNK;
+          for (j = 0; j < m; j++) {
+            h[j] = HT_HASH(BENCH_KEYV[i + j]);
+          }
+#if defined(__x86_64__)
+          if (v == 3) hash_reduce_avx2(h, m, nbucket, b + i);
+          else
+#endif
+          hash_reduce_scalar(h, m, nbucket, b + i);
+        }
+      }
+      c = (double) (cycles() - c0) / nkeys;
+      if (pass == 0 || c < best) best = c;
+    }
+    if (v >= 2) assert(memcmp(a, b, sizeof(uint32_t) * nkeys) == 0);
+    printf("hash: %-14s %6.2f cycles/key\n", name[v], best);
+  }
+  free(a);
+  free(b);
+}
+
+#ifdef HT_SHM
+// Fork nproc processes that each attach to the table by name and look up
+// every key, and report what attaching cost them. Their resident memory
+// grows by the pages of the segment they touch, which are the same
+// physical pages in every process rather than a copy each.
+static void
+HT_(processes)(void)
+{
+  pid_t *pids = malloc(sizeof(pid_t) * nproc);
+  double seg = HT_(bytes)(&HT_(tab)) / 1048576.0;
+  int i, status;
+
+  assert(pids);
+  fflush(stdout);
+  for (i = 0; i < nproc; i++) {
+    pids[i] = fork();
+    assert(pids[i] >= 0);
+    if (pids[i] == 0) {
+      struct HT_NAME t;
+      long rss0 = rss_kb(NULL), k = 0, j;
+      double t3, t2, t1, t0;
+
+      t0 = now();
+      assert(HT_(attach)(&t, HT_(tab).name));
+      t1 = now();
+      // the first pass also faults the segment's pages into this process
+      for (j = 0; j < nkeys; j++) {
+        if (HT_(get)(&t, BENCH_KEYV[j]) == 0) k++;
+      }
+      t2 = now();
+      for (j = 0; j < nkeys; j++) {
+        if (HT_(get)(&t, BENCH_KEYV[j]) == 0) k++;
+      }
+      t3 = now();
+      printf("process %d: attach time = %.1f us, %.0f then %.0f lookups/s, %ld keys missing, "
+             "rss +%.1f MB, %.1f MB of it the segment\n", i, 1e6 * (t1-t0),
+             nkeys / (t2-t1), nkeys / (t3-t2), k / 2, (rss_kb(NULL) - rss0) / 1024.0,
+             rss_kb(t.h) / 1024.0);
+      HT_(detach)(&t);
+      fflush(stdout);
+      _exit(0);
+    }
+  }
+  for (i = 0; i < nproc; i++) {
+    assert(waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  printf("shm: %d processes attached one %.1f MB segment; a copy each would take %.1f MB more\n",
+         nproc, seg, nproc * seg);
+  free(pids);
+}
+#endif
+
+#ifdef HT_ROBIN
+// Whether the first pass of the delete phase deletes key; all copies of
+// a key drawn more than once go together.
+static inline int
+HT_(doomed)(HT_KEY key)
+{
+  return bloom_mix(HT_HASH(key)) & 1;
+}
+
+struct HT_(delarg) {
+  long n;
+  double time[2];             // of the two passes
+  long deleted;
+  long wrong;                 // keys present that shouldn't be, or vice versa
+};
+
+// Delete the doomed keys of thread n's slice, check every key of the
+// slice once all threads have, then delete the rest.
+static void *
+HT_(delthread)(void *xa)
+{
+  struct HT_(delarg) *a = xa;
+  long lo = (long) nkeys * a->n / nthread;
+  long hi = (long) nkeys * (a->n + 1) / nthread;
+  double t0 = spinbarrier_wait(&HT_(bar), nthread);
+  long i;
+
+  for (i = lo; i < hi; i++) {
+    if (HT_(doomed)(BENCH_KEYV[i])) a->deleted += HT_(del)(&HT_(tab), BENCH_KEYV[i]);
+  }
+  a->time[0] = now() - t0;
+  spinbarrier_wait(&HT_(bar), nthread);
+  for (i = lo; i < hi; i++) {
+    if ((HT_(get)(&HT_(tab), BENCH_KEYV[i]) == 0) != HT_(doomed)(BENCH_KEYV[i])) a->wrong++;
+  }
+  t0 = spinbarrier_wait(&HT_(bar), nthread);
+  for (i = lo; i < hi; i++) {
+    a->deleted += HT_(del)(&HT_(tab), BENCH_KEYV[i]);
+  }
+  a->time[1] = now() - t0;
+  return NULL;
+}
+
+// Empty the table with HT_(delthread) and check that every key it held
+// was deleted once, and that no slot is left with a probe length.
+static void
+HT_(delrun)(void)
+{
+  struct HT_(delarg) *a = calloc(nthread, sizeof(*a));
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthread);
+  long used = 0, left = 0, deleted = 0, wrong = 0, pos;
+  double time[2] = { 0, 0 };
+  void *value;
+  int i, p;
+
+  assert(a && tha);
+  for (pos = 0; pos < HT_(tab).nslot; pos++) {
+    if (HT_(tab).slots[pos].psl != 0) used++;
+  }
+  for (i = 0; i < nthread; i++) {
+    a[i].n = i;
+    assert(pthread_create(&tha[i], NULL, HT_(delthread), &a[i]) == 0);
+  }
+  for (i = 0; i < nthread; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+    for (p = 0; p < 2; p++) {
+      if (a[i].time[p] > time[p]) time[p] = a[i].time[p];
+    }
+    deleted += a[i].deleted;
+    wrong += a[i].wrong;
+  }
+  for (pos = 0; pos < HT_(tab).nslot; pos++) {
+    if (HT_(tab).slots[pos].psl != 0) left++;
+  }
+  printf("delete: %ld of %ld keys, half time = %f, rest time = %f, %.0f deletes/s, "
+         "%ld keys wrong after half, %ld slots left\n", deleted, used, time[0], time[1],
+         deleted / (time[0] + time[1]), wrong, left);
+  assert(deleted == used && wrong == 0 && left == 0);
+  free(a);
+  free(tha);
+}
+#endif
+
+// Replay replaypath into a fresh table instead of the workload.
+static void
+HT_(replayrun)(struct bench *r)
+{
+  struct HT_(replayed) res;
+  long nrec = HT_(trace_count)(replaypath);
+  double t1, t0;
+
+  if (nrec < 0) {
+    fprintf(stderr, "%s: not a trace of this key type\n", replaypath);
+    exit(-1);
+  }
+  if (HT_(live)) HT_(destroy)(&HT_(tab));
+  HT_(init)(&HT_(tab), nbucket, HT_(nentry)(nrec));
+#ifdef HT_CACHE
+  HT_(tab).ttl = ttl;
+#endif
+  HT_(live) = 1;
+  t0 = now();
+  HT_(replay)(&HT_(tab), replaypath, nthread, paced, &res);
+  t1 = now();
+#ifdef HT_SHM
+  HT_(unname)(&HT_(tab));
+#endif
+  memset(r, 0, sizeof(*r));
+  r->get = t1-t0;
+  r->missing = res.nmiss;
+  if (quiet) return;
+  printf("replay: %ld ops, %ld gets, %ld missed, time = %f, %.0f ops/s\n",
+         res.nop, res.nget, res.nmiss, t1-t0, res.nop / (t1-t0));
+  HT_(report)(&HT_(tab), nrec);
+}
+
+// Serve a fresh table on servepath until a signal stops the server.
+static void
+HT_(serverun)(struct bench *r)
+{
+  long nreq, nfull, room = -1;
+  double t1, t0;
+
+  if (HT_(live)) HT_(destroy)(&HT_(tab));
+  HT_(init)(&HT_(tab), nbucket, HT_(nentry)(nkeys));
+#ifdef HT_CACHE
+  HT_(tab).ttl = ttl;
+#endif
+  HT_(live) = 1;
+  serve_stop = 0;
+  signal(SIGINT, serve_onsignal);
+  signal(SIGTERM, serve_onsignal);
+  if (!quiet) printf("serving on %s with %d threads\n", servepath, nthread);
+  fflush(stdout);
+  t0 = now();
+#if defined(HT_COMPACT) || defined(HT_SHM) || defined(HT_ROBIN)
+  room = nkeys;           // the pool or slots were sized for nkeys puts
+#endif
+  nreq = HT_(sockserve)(&HT_(tab), servepath, nthread, room, &nfull);
+  t1 = now();
+#ifdef HT_SHM
+  HT_(unname)(&HT_(tab));
+#endif
+  memset(r, 0, sizeof(*r));
+  if (quiet) return;
+  printf("served %ld requests in %f s, %ld puts refused as the table was full\n",
+         nreq, t1-t0, nfull);
+  HT_(report)(&HT_(tab), nkeys);
+}
+
+// Run the put and get phases against the server on loadpath.
+static void
+HT_(loadgen)(struct bench *r)
+{
+  HT_VALUE *vals = malloc(sizeof(HT_VALUE) * nkeys);
+  long n, i;
+
+  assert(vals);
+  for (n = 0; n < nthread; n++) {
+    for (i = (long) nkeys * n / nthread; i < (long) nkeys * (n + 1) / nthread; i++) {
+      vals[i] = HT_(valueat)(i, n);
+    }
+  }
+  memset(r, 0, sizeof(*r));
+  r->missing = HT_(sockload)(loadpath, nthread, pipeline, BENCH_KEYV, vals, nkeys);
+  free(vals);
+}
+
+static void
+HT_(run)(struct bench *r)
+{
+  pthread_t *tha;
+  void *value;
+  long i, nsync = 0;
+
+  if (replaypath) {
+    HT_(replayrun)(r);
+    return;
+  }
+  if (servepath) {
+    HT_(serverun)(r);
+    return;
+  }
+
+  if (BENCH_KEYV == NULL && keypath) {
+    BENCH_KEYV = keyfile_map(keypath, sizeof(HT_KEY), sizeof(HT_VALUE), (void **) &HT_(vals));
+  } else if (BENCH_KEYV == NULL) {
+    BENCH_KEYV = malloc(sizeof(HT_KEY) * nkeys);
+    assert(BENCH_KEYV);
+    srandom(0);
+    for (i = 0; i < nkeys; i++) {
+      BENCH_KEYV[i] = BENCH_KEY();
+    }
+    if (zipftheta > 0) {
+      // the distinct keys just drawn become the universe, in rank order
+      HT_KEY *u = BENCH_KEYV;
+      BENCH_KEYV = malloc(sizeof(HT_KEY) * nkeys);
+      assert(BENCH_KEYV);
+      zipf_init(nkeys, zipftheta);
+      for (i = 0; i < nkeys; i++) {
+        BENCH_KEYV[i] = u[zipf_next()];
+      }
+      free(u);
+    }
+  }
+  if (hashbench && !quiet) HT_(hashbench)();
+  if (genpath) {
+    HT_VALUE *vals = malloc(sizeof(HT_VALUE) * nkeys);
+    double t1, t0;
+    long n;
+
+    assert(vals);
+    for (n = 0; n < nthread; n++) {
+      for (i = (long) nkeys * n / nthread; i < (long) nkeys * (n + 1) / nthread; i++) {
+        vals[i] = BENCH_VALUE(n);
+      }
+    }
+    t0 = now();
+    keyfile_write(genpath, BENCH_KEYV, sizeof(HT_KEY), vals, sizeof(HT_VALUE), nkeys);
+    t1 = now();
+    free(vals);
+    memset(r, 0, sizeof(*r));
+    if (!quiet) printf("key file: %d keys written, time = %f\n", nkeys, t1-t0);
+    return;
+  }
+  if (loadpath) {
+    HT_(loadgen)(r);
+    return;
+  }
+#ifdef HT_CHAINED
+  if (hashjoin) {
+    HT_(joinrun)(r);
+    return;
+  }
+  if (aggregate) {
+    HT_(aggrun)(r);
+    return;
+  }
+#endif
+  if (missphase && HT_(misskeys) == NULL) {
+    HT_(misskeys) = malloc(sizeof(HT_KEY) * nkeys);
+    assert(HT_(misskeys));
+    srandom(2);  // glibc treats seeds 0 and 1 alike
+    for (i = 0; i < nkeys; i++) {
+      HT_(misskeys)[i] = BENCH_KEY();
+    }
+  }
+  // the table outlives the run for inspection; drop the previous one
+  if (HT_(live)) {
+    HT_(destroy)(&HT_(tab));
+#ifdef BENCH_RESET
+    BENCH_RESET();
+#endif
+  }
+  HT_(init)(&HT_(tab), nbucket, HT_(nentry)(nkeys));
+#ifdef HT_CHAINED
+  if (bloomfpr > 0) HT_(tab).bloom = bloom_new(nkeys, bloomfpr);
+  if (combining) HT_(combining)(&HT_(tab));
+#else
+  if (bulkload || interleave > 0 || bloomfpr > 0 || combining || stats || snapshot || freeze ||
+      hashjoin || aggregate) {
+    fprintf(stderr, "-B, -i, -f, -F, -S, -e, -Z, -J and -A need the chained table\n");
+    exit(-1);
+  }
+#endif
+#ifdef HT_CACHE
+  HT_(tab).ttl = ttl;
+#else
+  if (capacity > 0 || ttl > 0) {
+    fprintf(stderr, "-C and -T need the cache backend\n");
+    exit(-1);
+  }
+#endif
+#ifndef HT_ROBIN
+  if (deletes) {
+    fprintf(stderr, "-d needs the robin backend\n");
+    exit(-1);
+  }
+#endif
+#ifndef HT_SHM
+  if (nproc > 0) {
+    fprintf(stderr, "-P needs the shm backend\n");
+    exit(-1);
+  }
+#endif
+#ifdef HT_DELEGATE
+  if (delegate) HT_(deleg_init)(&HT_(dg), &HT_(tab), nthread);
+#else
+  if (delegate) {
+    fprintf(stderr, "-D needs the chained table\n");
+    exit(-1);
+  }
+#endif
+  HT_(live) = 1;
+  HT_(done) = 0;
+  HT_(res) = calloc(nthread, sizeof(struct bench));
+  tha = malloc(sizeof(pthread_t) * nthread);
+  if (walinterval >= 0) HT_(wal) = wal_open(walpath, nthread, walinterval);
+  if (recordpath) HT_(tr) = HT_(trace_create)(recordpath, nthread);
+  if (uringdepth > 0) HT_(uring_init)(&HT_(ur), &HT_(tab), nbucket, nthread, nthread, uringdepth);
+
+#ifdef HT_CHAINED
+  if (bulkload) {
+    // the same values the put phase would store
+    HT_VALUE *vals = malloc(sizeof(HT_VALUE) * nkeys);
+    double t1, t0;
+    long n;
+
+    assert(vals);
+    for (n = 0; n < nthread; n++) {
+      for (i = (long) nkeys * n / nthread; i < (long) nkeys * (n + 1) / nthread; i++) {
+        vals[i] = HT_(valueat)(i, n);
+      }
+    }
+    t0 = now();
+    HT_(bulk_load)(&HT_(tab), BENCH_KEYV, vals, nkeys, nthread);
+    t1 = now();
+    free(vals);
+    for (i = 0; i < nthread; i++) {
+      HT_(res)[i].put = t1-t0;
+    }
+    if (!quiet) printf("bulk load time = %f\n", t1-t0);
+  }
+#endif
+  for(i = 0; i < nthread; i++) {
+    assert(pthread_create(&tha[i], NULL, HT_(thread), (void *) i) == 0);
+  }
+#ifdef HT_CHAINED
+  if (snapshot) HT_(snapshots)();
+#endif
+  for(i = 0; i < nthread; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+
+#ifdef HT_DELEGATE
+  if (delegate) HT_(deleg_free)(&HT_(dg));
+#endif
+  if (uringdepth > 0) HT_(uring_free)(&HT_(ur));
+  if (HT_(wal)) {
+    nsync = wal_close(HT_(wal));
+    HT_(wal) = NULL;
+  }
+  if (HT_(tr)) {
+    trace_close(HT_(tr));
+    HT_(tr) = NULL;
+  }
+
+  // each phase lasts until its slowest thread is done
+  memset(r, 0, sizeof(*r));
+  for (i = 0; i < nthread; i++) {
+    if (HT_(res)[i].put > r->put) r->put = HT_(res)[i].put;
+    if (HT_(res)[i].get > r->get) r->get = HT_(res)[i].get;
+    if (HT_(res)[i].miss > r->miss) r->miss = HT_(res)[i].miss;
+    r->missing += HT_(res)[i].missing;
+    r->found += HT_(res)[i].found;
+    r->putcache = r->putcache < 0 || HT_(res)[i].putcache < 0 ? -1 : r->putcache + HT_(res)[i].putcache;
+    r->getcache = r->getcache < 0 || HT_(res)[i].getcache < 0 ? -1 : r->getcache + HT_(res)[i].getcache;
+  }
+  r->commits = nsync;
+  free(tha);
+  free(HT_(res));
+#ifdef HT_SHM
+  if (nproc == 0 || quiet) HT_(unname)(&HT_(tab));
+#endif
+  if (quiet) return;
+  printf("put throughput = %.0f puts/s\n", nkeys / r->put);
+  printf("get throughput = %.0f lookups/s, %.1f ns/lookup\n",
+         (double) nkeys * nthread / r->get, 1e9 * r->get / nkeys);
+#ifdef HT_CACHE
+  printf("hit ratio = %.4f\n", 1 - r->missing / ((double) nkeys * nthread));
+#endif
+  if (missphase) {
+    printf("miss throughput = %.0f lookups/s, %ld found\n",
+           (double) nkeys * nthread / r->miss, r->found);
+  }
+  if (cachemisses) {
+    if (r->putcache < 0 || r->getcache < 0) {
+      printf("cache misses: no hardware counter\n");
+    } else {
+      printf("cache misses = %.2f per put, %.2f per lookup\n",
+             (double) r->putcache / nkeys, (double) r->getcache / nkeys / nthread);
+    }
+  }
+  if (walinterval >= 0) {
+    printf("wal: %ld commits, %.1f puts/commit\n", nsync, nsync ? (double) nkeys / nsync : 0.0);
+    HT_(recover)();
+  }
+  HT_(report)(&HT_(tab), nkeys);
+#ifdef HT_SHM
+  if (nproc > 0) {
+    HT_(processes)();
+    HT_(unname)(&HT_(tab));
+  }
+#endif
+#ifdef HT_CHAINED
+  if (stats) {
+    struct ht_stats st;
+    double t1, t0;
+
+    t0 = now();
+    HT_(stats)(&HT_(tab), nthread, &st);
+    t1 = now();
+    ht_stats_print(&st);
+    printf("stats time = %f\n", t1-t0);
+  }
+  if (freeze) HT_(frozenrun)(r);
+#endif
+#ifdef HT_ROBIN
+  if (deletes) HT_(delrun)();
+#endif
+}
+
+#undef HT_NAME
+#undef HT_KEY
+#undef HT_VALUE
+#undef HT_HASH
+#undef HT_EQ
+#undef HT_INTERN
+#undef BENCH_KEY
+#undef BENCH_VALUE
+#undef BENCH_KEYS
+#undef BENCH_RESET
+#undef HT_COMPACT
+#undef HT_CHAINED
+#undef HT_DELEGATE
+#undef HT_CACHE
+#undef HT_SHM
+#undef HT_ROBIN
+#undef BENCH_KEYV
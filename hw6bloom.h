@@ -0,0 +1,117 @@
+// Blocked Bloom filter over 64-bit key hashes, for hw6table.h.
+//
+// Every key sets and tests k bits inside a single 64-byte block, so a
+// test costs one cache miss no matter what k is. Bits are only ever set,
+// with an atomic or, so concurrent adds and tests need no lock.
+
+#ifndef HW6BLOOM_H
+#define HW6BLOOM_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOOM_BLOCKWORDS 8      // 64-bit words per block: one cache line
+#define BLOOM_MAXK 16
+
+struct bloom {
+  uint64_t *blocks;
+  uint64_t mask;                // number of blocks - 1
+  int k;                        // bits set per key
+};
+
+static inline uint64_t
+bloom_mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Size the filter for n keys at false-positive rate fpr, using the
+// optimal k = log2(1/fpr) and m/n = k / ln(2) bits per key. Blocking
+// costs a little accuracy, so the block count is rounded up.
+static struct bloom *
+bloom_new(long n, double fpr)
+{
+  struct bloom *b = malloc(sizeof(struct bloom));
+  uint64_t nblock = 1;
+  double x;
+  int k = 0;
+
+  assert(b && fpr > 0 && fpr < 1);
+  for (x = fpr; x < 1; x *= 2) k++;
+  while (nblock * BLOOM_BLOCKWORDS * 64 < n * k * 1.4427) nblock <<= 1;
+  b->mask = nblock - 1;
+  b->k = k > BLOOM_MAXK ? BLOOM_MAXK : k;
+  b->blocks = aligned_alloc(64, nblock * BLOOM_BLOCKWORDS * sizeof(uint64_t));
+  assert(b->blocks);
+  memset(b->blocks, 0, nblock * BLOOM_BLOCKWORDS * sizeof(uint64_t));
+  return b;
+}
+
+static void
+bloom_free(struct bloom *b)
+{
+  free(b->blocks);
+  free(b);
+}
+
+static inline uint64_t *
+bloom_block(struct bloom *b, uint64_t h)
+{
+  return b->blocks + (bloom_mix(h) & b->mask) * BLOOM_BLOCKWORDS;
+}
+
+// Fill m with the bits of h's block that a key with hash h owns.
+static inline void
+bloom_bits(struct bloom *b, uint64_t h, uint64_t m[BLOOM_BLOCKWORDS])
+{
+  uint64_t x = bloom_mix(h ^ 0x9e3779b97f4a7c15ULL);
+  int i;
+
+  memset(m, 0, sizeof(uint64_t) * BLOOM_BLOCKWORDS);
+  for (i = 0; i < b->k; i++) {
+    if (i > 0 && i % 7 == 0) x = bloom_mix(x + i);  // 9 bits per probe
+    m[(x >> 6) & 7] |= 1ULL << (x & 63);
+    x >>= 9;
+  }
+}
+
+static inline void
+bloom_add(struct bloom *b, uint64_t h)
+{
+  uint64_t *blk = bloom_block(b, h);
+  uint64_t m[BLOOM_BLOCKWORDS];
+  int i;
+
+  bloom_bits(b, h, m);
+  for (i = 0; i < BLOOM_BLOCKWORDS; i++) {
+    if (m[i] && (__atomic_load_n(&blk[i], __ATOMIC_RELAXED) & m[i]) != m[i])
+      __sync_fetch_and_or(&blk[i], m[i]);
+  }
+}
+
+// 0 if a key with hash h was certainly never added.
+static inline int
+bloom_test(struct bloom *b, uint64_t h)
+{
+  uint64_t *blk = bloom_block(b, h);
+  uint64_t x = bloom_mix(h ^ 0x9e3779b97f4a7c15ULL), absent = 0;
+  int i;
+
+  // same probe sequence as bloom_bits, but straight off the block and
+  // with no early exit: one well-predicted branch instead of k
+  for (i = 0; i < b->k; i++) {
+    if (i > 0 && i % 7 == 0) x = bloom_mix(x + i);
+    absent |= ~__atomic_load_n(&blk[(x >> 6) & 7], __ATOMIC_RELAXED) >> (x & 63);
+    x >>= 9;
+  }
+  return (absent & 1) == 0;
+}
+
+#endif
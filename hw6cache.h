@@ -0,0 +1,261 @@
+// Template header for a capacity-bounded cache backend with CLOCK
+// (second-chance) eviction, with the same parameters and put/get
+// interface as hw6table.h.
+//
+// Entries live in a fixed pool of nentry slots, chained from the buckets
+// by 32-bit pool index as in the compact table. Until the pool is full a
+// put takes the next free slot; after that it runs the clock hand over
+// the pool. A slot whose reference bit is set gets it cleared and is
+// passed over once; the first slot found with the bit clear, or expired,
+// is unlinked from its bucket and reused. get() sets the bit with a plain
+// store, and takes no lock at all.
+//
+// The evicting put holds its own bucket lock and only trylocks the
+// victim's, skipping the victim if that fails, so there is no lock order
+// to keep. Slots are never freed, so a get can always read what it
+// walks to; each slot has a sequence count that is odd while it is being
+// reused, and a get that saw it change treats the key as a miss.
+//
+// Set t->ttl (milliseconds) after init to expire entries that long after
+// their put.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HT_INTERN
+#define HT_INTERN(k) (k)
+#endif
+
+#ifndef HW6CACHE_H
+#define HW6CACHE_H
+
+// Milliseconds on a cheap clock, for TTLs.
+static inline uint32_t
+cache_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif
+
+struct HT_(entry) {
+  uint32_t next;            // pool index; 0 is nil
+  uint32_t bucket;
+  volatile uint32_t seq;    // odd while the slot is being reused
+  volatile uint8_t ref;
+  uint32_t expires;         // cache_ms() deadline, if t->ttl
+  HT_KEY key;
+  HT_VALUE value;
+};
+
+struct HT_NAME {
+  long nbucket;
+  pthread_mutex_t *locks;
+  volatile uint32_t *table;
+  struct HT_(entry) *pool;  // capacity + 1 slots; slot 0 is nil
+  uint32_t capacity;
+  volatile uint32_t nused;  // slots handed out before the first eviction
+  volatile uint64_t hand;
+  long ttl;                 // milliseconds; 0: entries never expire
+  volatile long nevict;
+  volatile long nexpired;   // of the evictions
+};
+
+static void
+HT_(init)(struct HT_NAME *t, long nbucket, long nentry)
+{
+  long i;
+
+  assert(nentry > 0 && nentry < UINT32_MAX);
+  t->nbucket = nbucket;
+  t->locks = malloc(sizeof(pthread_mutex_t) * nbucket);
+  t->table = calloc(nbucket, sizeof(uint32_t));
+  t->pool = calloc(nentry + 1, sizeof(struct HT_(entry)));
+  assert(t->locks && t->table && t->pool);
+  for (i = 0; i < nbucket; i++) {
+    pthread_mutex_init(t->locks + i, NULL);
+  }
+  t->capacity = nentry;
+  t->nused = 0;
+  t->hand = 0;
+  t->ttl = 0;
+  t->nevict = t->nexpired = 0;
+}
+
+static void
+HT_(destroy)(struct HT_NAME *t)
+{
+  long i;
+
+  for (i = 0; i < t->nbucket; i++) {
+    pthread_mutex_destroy(t->locks + i);
+  }
+  free(t->locks);
+  free((void *) t->table);
+  free(t->pool);
+}
+
+static inline long
+HT_(bucket)(struct HT_NAME *t, HT_KEY key)
+{
+  return HT_HASH(key) % t->nbucket;
+}
+
+static inline int
+HT_(expired)(struct HT_NAME *t, struct HT_(entry) *e, uint32_t now)
+{
+  return t->ttl > 0 && (int32_t) (now - e->expires) >= 0;
+}
+
+// Unlink slot s from bucket b; the caller holds b's lock.
+static void
+HT_(unlink)(struct HT_NAME *t, long b, uint32_t s)
+{
+  volatile uint32_t *p = &t->table[b];
+
+  while (*p != s) p = &t->pool[*p].next;
+  *p = t->pool[s].next;
+}
+
+// A slot for a new entry in bucket b, whose lock the caller holds. It
+// comes with its sequence count odd.
+static uint32_t
+HT_(victim)(struct HT_NAME *t, long b)
+{
+  uint32_t s, now = t->ttl > 0 ? cache_ms() : 0;
+  struct HT_(entry) *e;
+  long vb;
+
+  if (t->nused < t->capacity) {
+    s = __sync_add_and_fetch(&t->nused, 1);
+    if (s <= t->capacity) {
+      __sync_fetch_and_add(&t->pool[s].seq, 1);
+      return s;
+    }
+  }
+  for (;;) {
+    s = __sync_fetch_and_add(&t->hand, 1) % t->capacity + 1;
+    e = &t->pool[s];
+    if (e->ref && !HT_(expired)(t, e, now)) {
+      e->ref = 0;           // second chance
+      continue;
+    }
+    vb = e->bucket;
+    if (vb != b && pthread_mutex_trylock(t->locks + vb) != 0) continue;
+    // under vb's lock, check that nobody is filling or took the slot
+    if (e->bucket == (uint32_t) vb && e->seq % 2 == 0) {
+      if (HT_(expired)(t, e, now)) __sync_fetch_and_add(&t->nexpired, 1);
+      HT_(unlink)(t, vb, s);
+      __sync_fetch_and_add(&e->seq, 1);
+      if (vb != b) pthread_mutex_unlock(t->locks + vb);
+      __sync_fetch_and_add(&t->nevict, 1);
+      return s;
+    }
+    if (vb != b) pthread_mutex_unlock(t->locks + vb);
+  }
+}
+
+// Insert, or overwrite the value if the key is present.
+static void
+HT_(put)(struct HT_NAME *t, HT_KEY key, HT_VALUE value)
+{
+  long b = HT_(bucket)(t, key);
+  struct HT_(entry) *e;
+  uint32_t s, fresh;
+
+  pthread_mutex_lock(t->locks + b);
+  for (s = t->table[b]; s != 0; s = t->pool[s].next) {
+    if (HT_EQ(t->pool[s].key, key)) break;
+  }
+  fresh = s == 0;
+  if (fresh) {
+    s = HT_(victim)(t, b);
+    e = &t->pool[s];
+    e->key = HT_INTERN(key);
+    e->ref = 0;
+    e->bucket = b;
+    e->next = t->table[b];
+  } else {
+    e = &t->pool[s];
+    __sync_fetch_and_add(&e->seq, 1);
+  }
+  e->value = value;
+  if (t->ttl > 0) e->expires = cache_ms() + t->ttl;
+  __sync_fetch_and_add(&e->seq, 1);
+  if (fresh) __atomic_store_n(&t->table[b], s, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(t->locks + b);
+}
+
+// The entry holding key, or 0, with a consistent copy of its value.
+static inline struct HT_(entry) *
+HT_(find)(struct HT_NAME *t, HT_KEY key, HT_VALUE *value)
+{
+  uint32_t s, seq, steps = 0;
+  struct HT_(entry) *e;
+  HT_VALUE v;
+
+  // a slot reused mid-walk can lead into another chain; the step bound
+  // keeps such a walk finite
+  for (s = __atomic_load_n(&t->table[HT_(bucket)(t, key)], __ATOMIC_ACQUIRE);
+       s != 0 && steps++ < t->capacity; s = e->next) {
+    e = &t->pool[s];
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (seq % 2 != 0 || !HT_EQ(e->key, key)) continue;
+    v = e->value;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq) return 0;
+    if (t->ttl > 0 && HT_(expired)(t, e, cache_ms())) return 0;
+    if (!e->ref) e->ref = 1;  // only dirty the line once
+    *value = v;
+    return e;
+  }
+  return 0;
+}
+
+// The slot may be reused for another key after the return; HT_(lookup)
+// copies the value out consistently.
+static struct HT_(entry) *
+HT_(get)(struct HT_NAME *t, HT_KEY key)
+{
+  HT_VALUE v;
+  return HT_(find)(t, key, &v);
+}
+
+// Copy key's value to *value; 0 on a miss.
+static inline int
+HT_(lookup)(struct HT_NAME *t, HT_KEY key, HT_VALUE *value)
+{
+  return HT_(find)(t, key, value) != 0;
+}
+
+static size_t
+HT_(bytes)(struct HT_NAME *t)
+{
+  return (sizeof(pthread_mutex_t) + sizeof(uint32_t)) * t->nbucket +
+    sizeof(struct HT_(entry)) * (t->capacity + 1);
+}
+
+static void
+HT_(report)(struct HT_NAME *t, long n)
+{
+  (void) n;
+  printf("cache: capacity %u, %u slots used, %ld evictions, %ld of them expired, "
+         "%.1f bytes/slot\n", t->capacity, t->nused < t->capacity ? t->nused : t->capacity,
+         t->nevict, t->nexpired, (double) HT_(bytes)(t) / t->capacity);
+}
+
+#define HT_CACHE
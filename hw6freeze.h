@@ -0,0 +1,387 @@
+// Freezing a chained table (hw6table.h) into an immutable one: include
+// right after it, with the same HT_ parameters.
+//
+// HT_(freeze) builds a minimal perfect hash over the table's keys and
+// lays the entries out densely in its order, so a frozen lookup is one
+// hash, one read of a 16-bit pilot and one read of the entry, which also
+// holds the key to tell a miss.
+//
+// The hash is in the PTHash style. Keys are split by hash into
+// partitions of about FREEZE_PART, built independently, so threads build
+// partitions in parallel. Within a partition each key falls in a bucket
+// of about FREEZE_LAMBDA keys. Buckets are placed largest first, each
+// searching for the pilot that sends all its keys to free slots of a
+// table FREEZE_SLACK percent bigger than the partition. The slots past
+// the partition's end are then remapped to the holes left before it,
+// which makes the hash minimal. A partition with a bucket no pilot fits
+// starts over with another seed.
+//
+// The table must not change during the freeze; the frozen copy is
+// independent of it afterwards. Where the table holds a key more than
+// once, the copy keeps the value get() would return.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef HW6FREEZE_H
+#define HW6FREEZE_H
+
+#define FREEZE_PART 2048      // keys per partition, on average
+#define FREEZE_LAMBDA 4       // keys per bucket, on average
+#define FREEZE_SLACK 3        // percent more slots than keys
+#define FREEZE_MAXPILOT 65536
+#define FREEZE_MAXSEED 64
+
+struct freeze_part {
+  uint32_t base;            // first entry
+  uint32_t n;               // keys
+  uint32_t m;               // slots; those from n on are remapped
+  uint32_t nbucket;
+  uint32_t pilots;          // first pilot
+  uint32_t remap;           // first remap entry
+  uint64_t seed;
+};
+
+// x scaled from [0, 2^32) to [0, n).
+static inline uint32_t
+freeze_range(uint32_t x, uint32_t n)
+{
+  return (uint64_t) x * n >> 32;
+}
+
+static inline uint32_t
+freeze_slot(uint64_t h, uint64_t seed, uint32_t pilot, uint32_t m)
+{
+  return freeze_range(bloom_mix(h ^ (seed * FREEZE_MAXPILOT + pilot) * 0x9e3779b97f4a7c15ULL) >> 32, m);
+}
+
+#endif
+
+struct HT_(fentry) {
+  HT_KEY key;
+  HT_VALUE value;
+};
+
+struct HT_(frozen) {
+  long n;
+  uint32_t npart;
+  struct freeze_part *parts;
+  uint16_t *pilots;
+  uint16_t *remap;
+  struct HT_(fentry) *entries;
+};
+
+// A key on its way into the frozen table, with its mixed hash.
+struct HT_(fitem) {
+  uint64_t h;
+  HT_KEY key;
+  HT_VALUE value;
+};
+
+struct HT_(freeze) {
+  struct HT_NAME *t;
+  struct HT_(frozen) *z;
+  int nthreads;
+  int phase;
+  struct HT_(fitem) **mine;   // per thread, the keys of its buckets
+  long *nmine;
+  long *hist;                 // nthreads x npart counts, then offsets
+  struct HT_(fitem) *items;   // all keys, partition by partition
+  volatile uint32_t nextpart;
+};
+
+struct HT_(freezeworker) {
+  struct HT_(freeze) *f;
+  int id;
+};
+
+static inline struct HT_(fentry) *
+HT_(frozen_get)(struct HT_(frozen) *z, HT_KEY key)
+{
+  uint64_t h = bloom_mix(HT_HASH(key));
+  struct freeze_part *p = &z->parts[freeze_range(h >> 32, z->npart)];
+  struct HT_(fentry) *e;
+  uint32_t pos;
+
+  if (p->n == 0) return 0;
+  pos = freeze_slot(h, p->seed, z->pilots[p->pilots + freeze_range(h, p->nbucket)], p->m);
+  if (pos >= p->n) pos = z->remap[p->remap + pos - p->n];
+  e = &z->entries[p->base + pos];
+  return HT_EQ(e->key, key) ? e : 0;
+}
+
+// Find a pilot for every bucket of partition p; 0 if some bucket has
+// none with this seed. order lists the keys bucket by bucket, largest
+// bucket first, and start[b] where bucket b begins in it.
+static int
+HT_(freezeplace)(struct HT_(frozen) *z, struct freeze_part *p, struct HT_(fitem) *it,
+                 uint32_t *order, uint32_t *start, uint32_t *size, uint8_t *taken,
+                 uint32_t *slot)
+{
+  uint32_t i, j, k, b, pilot;
+
+  memset(taken, 0, p->m);
+  for (i = 0; i < p->nbucket; i++) {
+    b = order[p->n + i];      // buckets follow the keys in order[]
+    if (size[b] == 0) break;
+    for (pilot = 0; pilot < FREEZE_MAXPILOT; pilot++) {
+      for (j = 0; j < size[b]; j++) {
+        slot[j] = freeze_slot(it[order[start[b] + j]].h, p->seed, pilot, p->m);
+        if (taken[slot[j]]) break;
+        taken[slot[j]] = 1;
+      }
+      if (j == size[b]) break;
+      for (k = 0; k < j; k++) {
+        taken[slot[k]] = 0;
+      }
+    }
+    if (pilot == FREEZE_MAXPILOT) return 0;
+    z->pilots[p->pilots + b] = pilot;
+  }
+  return 1;
+}
+
+static void
+HT_(freezepart)(struct HT_(frozen) *z, struct freeze_part *p, struct HT_(fitem) *it)
+{
+  uint32_t *order = malloc(sizeof(uint32_t) * (p->n + p->nbucket));
+  uint32_t *start = calloc(p->nbucket + 1, sizeof(uint32_t));
+  uint32_t *size = calloc(p->nbucket, sizeof(uint32_t));
+  uint32_t *bysize, slot[256], maxsize = 0, i, b, pos, hole;
+  uint8_t *taken = malloc(p->m + 1);
+
+  assert(order && start && size && taken);
+  for (i = 0; i < p->n; i++) {
+    size[freeze_range(it[i].h, p->nbucket)]++;
+  }
+  for (b = 0; b < p->nbucket; b++) {
+    start[b + 1] = start[b] + size[b];
+    if (size[b] > maxsize) maxsize = size[b];
+  }
+  assert(maxsize <= 256);
+  for (i = 0; i < p->n; i++) {
+    b = freeze_range(it[i].h, p->nbucket);
+    order[start[b]++] = i;
+  }
+  for (b = 0; b < p->nbucket; b++) {
+    start[b] -= size[b];
+  }
+  // counting sort of the buckets by size, largest first
+  bysize = calloc(maxsize + 2, sizeof(uint32_t));
+  assert(bysize);
+  for (b = 0; b < p->nbucket; b++) {
+    bysize[maxsize - size[b] + 1]++;
+  }
+  for (i = 0; i <= maxsize; i++) {
+    bysize[i + 1] += bysize[i];
+  }
+  for (b = 0; b < p->nbucket; b++) {
+    order[p->n + bysize[maxsize - size[b]]++] = b;
+  }
+  free(bysize);
+
+  while (!HT_(freezeplace)(z, p, it, order, start, size, taken, slot)) {
+    p->seed++;
+    assert(p->seed < (uint64_t) p->base + FREEZE_MAXSEED);
+  }
+  // remap the slots past n to the holes before it
+  hole = 0;
+  for (pos = p->n; pos < p->m; pos++) {
+    if (!taken[pos]) continue;
+    while (taken[hole]) hole++;
+    z->remap[p->remap + pos - p->n] = hole++;
+  }
+  for (i = 0; i < p->n; i++) {
+    pos = freeze_slot(it[i].h, p->seed, z->pilots[p->pilots + freeze_range(it[i].h, p->nbucket)], p->m);
+    if (pos >= p->n) pos = z->remap[p->remap + pos - p->n];
+    z->entries[p->base + pos].key = it[i].key;
+    z->entries[p->base + pos].value = it[i].value;
+  }
+  free(order);
+  free(start);
+  free(size);
+  free(taken);
+}
+
+// Drop the keys of it[0..n) shadowed by an earlier one with the same key,
+// as get() would; returns how many are left.
+static long
+HT_(freezededup)(struct HT_(fitem) *it, long n)
+{
+  long size = 2, i, j, m = 0;
+  uint32_t *set;
+
+  while (size < 2 * n) size *= 2;
+  set = calloc(size, sizeof(uint32_t));     // it index + 1; 0 is empty
+  assert(set && n < UINT32_MAX);
+  for (i = 0; i < n; i++) {
+    for (j = it[i].h & (size - 1); set[j] != 0; j = (j + 1) & (size - 1)) {
+      if (it[set[j] - 1].h == it[i].h && HT_EQ(it[set[j] - 1].key, it[i].key)) break;
+    }
+    if (set[j] != 0) continue;
+    it[m] = it[i];
+    set[j] = ++m;
+  }
+  free(set);
+  return m;
+}
+
+static void *
+HT_(freezethread)(void *xa)
+{
+  struct HT_(freezeworker) *w = xa;
+  struct HT_(freeze) *f = w->f;
+  struct HT_NAME *t = f->t;
+  struct HT_(frozen) *z = f->z;
+  long lo = (long) t->nbucket * w->id / f->nthreads;
+  long hi = (long) t->nbucket * (w->id + 1) / f->nthreads;
+  long *h = f->hist + (long) w->id * z->npart;
+  long i, cap = 0, n = 0;
+  struct HT_(entry) *e;
+  struct HT_(fitem) *mine = NULL;
+  uint32_t p;
+
+  switch (f->phase) {
+  case 0:  // collect this thread's buckets, newest first in each chain
+    for (i = lo; i < hi; i++) {
+      for (e = HT_(deref)(t, t->table[i]); e != 0; e = HT_(deref)(t, e->next)) {
+        if (n == cap) {
+          cap = cap ? 2 * cap : 1024;
+          mine = realloc(mine, sizeof(*mine) * cap);
+          assert(mine);
+        }
+        mine[n].h = bloom_mix(HT_HASH(e->key));
+        mine[n].key = e->key;
+        mine[n].value = e->value;
+        n++;
+      }
+    }
+    f->mine[w->id] = mine;
+    f->nmine[w->id] = HT_(freezededup)(mine, n);
+    break;
+  case 1:  // histogram by partition
+    for (i = 0; i < f->nmine[w->id]; i++) {
+      h[freeze_range(f->mine[w->id][i].h >> 32, z->npart)]++;
+    }
+    break;
+  case 2:  // scatter into partition order
+    for (i = 0; i < f->nmine[w->id]; i++) {
+      f->items[h[freeze_range(f->mine[w->id][i].h >> 32, z->npart)]++] = f->mine[w->id][i];
+    }
+    free(f->mine[w->id]);
+    break;
+  case 3:  // build whole partitions
+    while ((p = __sync_fetch_and_add(&f->nextpart, 1)) < z->npart) {
+      if (z->parts[p].n > 0) HT_(freezepart)(z, &z->parts[p], f->items + z->parts[p].base);
+    }
+    break;
+  }
+  return NULL;
+}
+
+static void
+HT_(freezephase)(struct HT_(freeze) *f, int phase)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * f->nthreads);
+  struct HT_(freezeworker) *w = malloc(sizeof(*w) * f->nthreads);
+  void *value;
+  int i;
+
+  assert(tha && w);
+  f->phase = phase;
+  for (i = 0; i < f->nthreads; i++) {
+    w[i].f = f;
+    w[i].id = i;
+    assert(pthread_create(&tha[i], NULL, HT_(freezethread), &w[i]) == 0);
+  }
+  for (i = 0; i < f->nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+  free(w);
+  free(tha);
+}
+
+// A frozen copy of t, built on nthreads threads.
+static struct HT_(frozen) *
+HT_(freeze)(struct HT_NAME *t, int nthreads)
+{
+  struct HT_(frozen) *z = calloc(1, sizeof(*z));
+  struct HT_(freeze) f;
+  long n = 0, off = 0, c;
+  uint32_t p, npilot = 0, nremap = 0;
+  int i;
+
+  assert(z);
+  f.t = t;
+  f.z = z;
+  f.nthreads = nthreads;
+  f.mine = malloc(sizeof(*f.mine) * nthreads);
+  f.nmine = malloc(sizeof(long) * nthreads);
+  assert(f.mine && f.nmine);
+  HT_(freezephase)(&f, 0);
+  for (i = 0; i < nthreads; i++) {
+    n += f.nmine[i];
+  }
+  assert(n < UINT32_MAX);
+  z->n = n;
+  z->npart = n / FREEZE_PART + 1;
+  z->parts = calloc(z->npart, sizeof(struct freeze_part));
+  f.hist = calloc((long) nthreads * z->npart, sizeof(long));
+  f.items = malloc(sizeof(struct HT_(fitem)) * (n + 1));
+  assert(z->parts && f.hist && f.items);
+  HT_(freezephase)(&f, 1);
+  // partition-major offsets, and each partition's share of the arrays
+  for (p = 0; p < z->npart; p++) {
+    struct freeze_part *q = &z->parts[p];
+
+    q->base = off;
+    for (i = 0; i < nthreads; i++) {
+      c = f.hist[(long) i * z->npart + p];
+      f.hist[(long) i * z->npart + p] = off;
+      off += c;
+    }
+    q->n = off - q->base;
+    q->m = q->n + q->n * FREEZE_SLACK / 100;
+    q->nbucket = q->n / FREEZE_LAMBDA + 1;
+    q->pilots = npilot;
+    q->remap = nremap;
+    q->seed = q->base;      // differs per partition
+    npilot += q->nbucket;
+    nremap += q->m - q->n;
+  }
+  z->pilots = calloc(npilot, sizeof(uint16_t));
+  z->remap = calloc(nremap + 1, sizeof(uint16_t));
+  z->entries = malloc(sizeof(struct HT_(fentry)) * (n + 1));
+  assert(z->pilots && z->remap && z->entries);
+  HT_(freezephase)(&f, 2);
+  f.nextpart = 0;
+  HT_(freezephase)(&f, 3);
+  free(f.items);
+  free(f.hist);
+  free(f.mine);
+  free(f.nmine);
+  return z;
+}
+
+static size_t
+HT_(frozen_bytes)(struct HT_(frozen) *z)
+{
+  struct freeze_part *last = &z->parts[z->npart - 1];
+
+  return sizeof(*z) + sizeof(struct freeze_part) * z->npart +
+    sizeof(uint16_t) * (last->pilots + last->nbucket + last->remap + last->m - last->n) +
+    sizeof(struct HT_(fentry)) * z->n;
+}
+
+static void
+HT_(frozen_free)(struct HT_(frozen) *z)
+{
+  free(z->parts);
+  free(z->pilots);
+  free(z->remap);
+  free(z->entries);
+  free(z);
+}
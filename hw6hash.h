@@ -0,0 +1,136 @@
+// Batch reduction of 64-bit key hashes to bucket indices, for hw6table.h.
+//
+// hash_reduce computes h % d for a batch of hashes, with d below 2^31.
+// On x86-64 it uses an AVX2 kernel, HASH_BATCH hashes at a time, if
+// CPUID says the CPU has AVX2, and a scalar loop otherwise. Both give
+// exactly h % d, so batch and single-key paths agree on every bucket.
+// Each call sets up the divisor, so callers reduce HASH_CHUNK at a time.
+//
+// AVX2 has no integer division. The kernel divides in double precision
+// and corrects the quotient with integer arithmetic. A 64-bit hash does
+// not fit a double's 53 bits, so it reduces in two 32-bit steps:
+// h % d = ((hi % d) * 2^32 + lo) % d. In each step the double quotient
+// is off by at most one, and one compare-and-adjust each way fixes it.
+
+#ifndef HW6HASH_H
+#define HW6HASH_H
+
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define HASH_BATCH 8            // hashes per AVX2 kernel step
+#define HASH_CHUNK 256          // hashes a caller should reduce per call
+
+static void
+hash_reduce_scalar(const uint64_t *h, int n, uint32_t d, uint32_t *out)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    out[i] = h[i] % d;
+  }
+}
+
+#if defined(__x86_64__)
+#define HASH_AVX2 __attribute__((target("avx2")))
+#define HASH_MAGIC 4503599627370496.0  // 2^52
+
+// The 64-bit lanes of x, each below 2^52, as doubles.
+HASH_AVX2 static inline __m256d
+hash_todouble(__m256i x)
+{
+  __m256d m = _mm256_set1_pd(HASH_MAGIC);
+  return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(x, _mm256_castpd_si256(m))), m);
+}
+
+// The floors of the lanes of x, each in [0, 2^52), as 64-bit integers.
+HASH_AVX2 static inline __m256i
+hash_toint(__m256d x)
+{
+  __m256d m = _mm256_set1_pd(HASH_MAGIC);
+  return _mm256_xor_si256(_mm256_castpd_si256(_mm256_add_pd(_mm256_floor_pd(x), m)),
+                          _mm256_castpd_si256(m));
+}
+
+// x % d for lanes x below d * 2^32, given xd, x as a double to within
+// 2^-52, and inv = 1.0 / d.
+HASH_AVX2 static inline __m256i
+hash_mod4(__m256i x, __m256d xd, __m256i dv, __m256d inv)
+{
+  __m256i qmax = _mm256_set1_epi64x(UINT32_MAX);
+  __m256i q = hash_toint(_mm256_mul_pd(xd, inv));
+  __m256i r;
+
+  // a quotient rounded up to 2^32 would lose its top bit in mul_epu32
+  q = _mm256_blendv_epi8(q, qmax, _mm256_cmpgt_epi64(q, qmax));
+  r = _mm256_sub_epi64(x, _mm256_mul_epu32(q, dv));
+  r = _mm256_add_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(_mm256_setzero_si256(), r), dv));
+  r = _mm256_sub_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(r, _mm256_sub_epi64(dv,
+                         _mm256_set1_epi64x(1))), dv));
+  return r;
+}
+
+// h % d for 4 hashes, packed into the low 128 bits.
+HASH_AVX2 static inline __m128i
+hash_reduce4(__m256i h, __m256i dv, __m256d inv)
+{
+  __m256i lo = _mm256_and_si256(h, _mm256_set1_epi64x(UINT32_MAX));
+  __m256i hi = _mm256_srli_epi64(h, 32);
+  __m256i r;
+
+  // hashes below 2^32, such as int keys', skip the first step
+  if (_mm256_testz_si256(hi, hi)) r = hi;
+  else r = hash_mod4(hi, hash_todouble(hi), dv, inv);
+  r = hash_mod4(_mm256_or_si256(_mm256_slli_epi64(r, 32), lo),
+                _mm256_add_pd(_mm256_mul_pd(hash_todouble(r), _mm256_set1_pd(4294967296.0)),
+                              hash_todouble(lo)), dv, inv);
+  r = _mm256_permutevar8x32_epi32(r, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+  return _mm256_castsi256_si128(r);
+}
+
+HASH_AVX2 static void
+hash_reduce_avx2(const uint64_t *h, int n, uint32_t d, uint32_t *out)
+{
+  __m256i dv = _mm256_set1_epi64x(d);
+  __m256d inv = _mm256_set1_pd(1.0 / d);
+  int i;
+
+  for (i = 0; i + HASH_BATCH <= n; i += HASH_BATCH) {
+    __m128i a = hash_reduce4(_mm256_loadu_si256((const __m256i *) (h + i)), dv, inv);
+    __m128i b = hash_reduce4(_mm256_loadu_si256((const __m256i *) (h + i + 4)), dv, inv);
+    _mm_storeu_si128((__m128i *) (out + i), a);
+    _mm_storeu_si128((__m128i *) (out + i + 4), b);
+  }
+  hash_reduce_scalar(h + i, n - i, d, out + i);
+}
+#endif
+
+// Nonzero if hash_reduce uses the AVX2 kernel.
+static int
+hash_avx2(void)
+{
+#if defined(__x86_64__)
+  static int avx2 = -1;
+
+  if (avx2 < 0) avx2 = __builtin_cpu_supports("avx2") != 0;
+  return avx2;
+#else
+  return 0;
+#endif
+}
+
+static inline void
+hash_reduce(const uint64_t *h, int n, uint32_t d, uint32_t *out)
+{
+#if defined(__x86_64__)
+  if (hash_avx2()) {
+    hash_reduce_avx2(h, n, d, out);
+    return;
+  }
+#endif
+  hash_reduce_scalar(h, n, d, out);
+}
+
+#endif
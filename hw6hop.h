@@ -0,0 +1,438 @@
+// Template header for a hopscotch-hashing backend (Herlihy, Shavit and
+// Tzafrir, "Hopscotch hashing"), with the same parameters and put/get
+// interface as hw6table.h.
+//
+// Every key lives within HOP_H slots of its home slot, and each home slot
+// keeps a bitmap of which of those HOP_H slots hold its keys, so a lookup
+// reads one bitmap and the few slots it names. An insert that finds its
+// nearest free slot too far away hops it closer, moving some nearer
+// entry into it, until it is in range.
+//
+// Near full load a dense run of homes can leave nothing to hop. Rather
+// than fail, such keys go to a shared overflow list, and their home's
+// bitmap gets the HOP_STASHED bit so that only its lookups look there.
+// The list is meant as a rare fallback, so once it holds more than one
+// key per HOP_GROW home slots, the put that overflowed doubles the home
+// slots and rehashes everything, list included.
+//
+// Writers lock HOP_SEGMENT-slot segments, ascending from the lowest home
+// slot whose entries they may move. Probes never wrap, so that order is
+// acyclic. Readers take no lock: each segment has a sequence count that
+// writers make odd while they move one of its home slots' entries, and a
+// reader that saw it change retries.
+//
+// A resize takes every segment lock, builds the new arrays, then swaps
+// them in under a table-wide sequence count, gen, that readers also check.
+// A writer that waited on a lock of the old arrays sees them gone and
+// starts over. Readers may still be in the old arrays, and a returned
+// entry may point into them, so they stay allocated until destroy.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HT_INTERN
+#define HT_INTERN(k) (k)
+#endif
+
+#ifndef HW6HOP_H
+#define HW6HOP_H
+#define HOP_H 31              // neighborhood size
+#define HOP_STASHED (1U << 31)  // hop bit: some keys homed here overflowed
+#define HOP_SEGMENT 256       // slots per writer lock and sequence count
+#define HOP_RANGE 4096        // farthest an insert searches for a free slot
+#define HOP_GROW 1024         // resize once the overflow list holds a key
+                              // per this many home slots
+#endif
+
+struct HT_(entry) {
+  uint32_t hop;             // bit i: slot home+i holds a key homed here
+  uint8_t used;
+  HT_KEY key;
+  HT_VALUE value;
+};
+
+struct HT_(stash) {
+  struct HT_(entry) e;
+  struct HT_(stash) *next;
+};
+
+// The arrays a resize replaced, kept for readers that may still be in
+// them.
+struct HT_(old) {
+  long nslot;
+  struct HT_(entry) *slots;
+  pthread_mutex_t *locks;
+  volatile unsigned *seq;
+  struct HT_(stash) *stash;
+  struct HT_(old) *next;
+};
+
+struct HT_NAME {
+  volatile unsigned gen;    // odd while a resize swaps the arrays
+  long nbucket;             // home slots
+  long nslot;               // plus room for the last neighborhoods
+  struct HT_(entry) *slots;
+  pthread_mutex_t *locks;
+  volatile unsigned *seq;   // per segment; odd while entries move
+  pthread_mutex_t stashlock;
+  struct HT_(stash) *stash; // overflow list, newest first
+  long nstash;
+  long nfail;               // inserts that overflowed, before resizes too
+  int ngrow;                // resizes
+  pthread_mutex_t growlock;
+  struct HT_(old) *old;
+};
+
+// Allocate the arrays for nbucket home slots, with an empty overflow list.
+static void
+HT_(alloc)(struct HT_NAME *t, long nbucket)
+{
+  long i, nseg;
+
+  t->nbucket = nbucket;
+  t->nslot = nbucket + HOP_RANGE;
+  nseg = t->nslot / HOP_SEGMENT + 1;
+  t->slots = calloc(t->nslot, sizeof(struct HT_(entry)));
+  t->locks = malloc(sizeof(pthread_mutex_t) * nseg);
+  t->seq = calloc(nseg, sizeof(unsigned));
+  assert(t->slots && t->locks && t->seq);
+  for (i = 0; i < nseg; i++) {
+    pthread_mutex_init(t->locks + i, NULL);
+  }
+  t->stash = NULL;
+  t->nstash = 0;
+}
+
+static void
+HT_(init)(struct HT_NAME *t, long nbucket, long nentry)
+{
+  (void) nentry;
+  HT_(alloc)(t, nbucket);
+  pthread_mutex_init(&t->stashlock, NULL);
+  pthread_mutex_init(&t->growlock, NULL);
+  t->gen = 0;
+  t->nfail = 0;
+  t->ngrow = 0;
+  t->old = NULL;
+}
+
+static void
+HT_(release)(long nslot, struct HT_(entry) *slots, pthread_mutex_t *locks,
+             volatile unsigned *seq, struct HT_(stash) *stash)
+{
+  struct HT_(stash) *next;
+  long i;
+
+  for (i = 0; i <= nslot / HOP_SEGMENT; i++) {
+    pthread_mutex_destroy(locks + i);
+  }
+  for (; stash != NULL; stash = next) {
+    next = stash->next;
+    free(stash);
+  }
+  free(slots);
+  free(locks);
+  free((void *) seq);
+}
+
+static void
+HT_(destroy)(struct HT_NAME *t)
+{
+  struct HT_(old) *o, *next;
+
+  HT_(release)(t->nslot, t->slots, t->locks, t->seq, t->stash);
+  for (o = t->old; o != NULL; o = next) {
+    next = o->next;
+    HT_(release)(o->nslot, o->slots, o->locks, o->seq, o->stash);
+    free(o);
+  }
+  pthread_mutex_destroy(&t->stashlock);
+  pthread_mutex_destroy(&t->growlock);
+}
+
+static inline long
+HT_(bucket)(struct HT_NAME *t, HT_KEY key)
+{
+  return HT_HASH(key) % t->nbucket;
+}
+
+// Lock segments up to the one holding slot pos; held NULL locks nothing,
+// for a table no other thread can see yet.
+static inline void
+HT_(reach)(struct HT_NAME *t, long pos, long *held)
+{
+  if (held == NULL) return;
+  while (pos / HOP_SEGMENT > *held) {
+    pthread_mutex_lock(t->locks + ++*held);
+  }
+}
+
+static struct HT_(entry) *
+HT_(stashget)(struct HT_NAME *t, HT_KEY key)
+{
+  struct HT_(stash) *o;
+
+  for (o = __atomic_load_n(&t->stash, __ATOMIC_ACQUIRE); o != NULL; o = o->next) {
+    if (HT_EQ(o->e.key, key)) return &o->e;
+  }
+  return 0;
+}
+
+// Put key in the overflow list; the caller holds home's segment lock.
+static void
+HT_(stashput)(struct HT_NAME *t, long home, HT_KEY key, HT_VALUE value)
+{
+  struct HT_(stash) *o = malloc(sizeof(struct HT_(stash)));
+
+  assert(o);
+  o->e.key = key;
+  o->e.value = value;
+  o->e.used = 1;
+  pthread_mutex_lock(&t->stashlock);
+  o->next = t->stash;
+  __atomic_store_n(&t->stash, o, __ATOMIC_RELEASE);
+  t->nstash++;
+  t->nfail++;
+  pthread_mutex_unlock(&t->stashlock);
+  __atomic_or_fetch(&t->slots[home].hop, HOP_STASHED, __ATOMIC_RELEASE);
+}
+
+// Move the entry homed at b from slot from to the free slot to.
+static void
+HT_(move)(struct HT_NAME *t, long b, long from, long to)
+{
+  volatile unsigned *seq = &t->seq[b / HOP_SEGMENT];
+
+  __sync_fetch_and_add(seq, 1);
+  t->slots[to].key = t->slots[from].key;
+  t->slots[to].value = t->slots[from].value;
+  t->slots[to].used = 1;
+  t->slots[b].hop |= 1U << (to - b);
+  t->slots[b].hop &= ~(1U << (from - b));
+  t->slots[from].used = 0;
+  __sync_fetch_and_add(seq, 1);
+}
+
+// Insert key, which is absent and interned, at its home or as near as
+// hopping gets it, or else in the overflow list. held is as for reach.
+static void
+HT_(insert)(struct HT_NAME *t, long home, HT_KEY key, HT_VALUE value, long *held)
+{
+  long f, b;
+  uint32_t hop;
+  int i;
+
+  for (f = home; f < home + HOP_RANGE; f++) {
+    HT_(reach)(t, f, held);
+    if (!t->slots[f].used) break;
+  }
+  // hop the free slot back until it is in home's neighborhood
+  while (f < home + HOP_RANGE && f - home >= HOP_H) {
+    for (b = f - HOP_H + 1; b < f; b++) {
+      hop = t->slots[b].hop & ((1U << (f - b)) - 1);  // entries before f
+      if (hop) break;
+    }
+    if (b == f) break;
+    i = __builtin_ctz(hop);
+    HT_(move)(t, b, b + i, f);
+    f = b + i;
+  }
+  if (f - home >= HOP_H) {
+    HT_(stashput)(t, home, key, value);
+    return;
+  }
+  t->slots[f].key = key;
+  t->slots[f].value = value;
+  t->slots[f].used = 1;
+  __atomic_or_fetch(&t->slots[home].hop, 1U << (f - home), __ATOMIC_RELEASE);
+}
+
+// Double the home slots and rehash, unless another put already resized
+// the table from nbucket.
+static void
+HT_(grow)(struct HT_NAME *t, long nbucket)
+{
+  struct HT_NAME n;
+  struct HT_(old) *o;
+  struct HT_(stash) *s;
+  long i, nseg;
+
+  pthread_mutex_lock(&t->growlock);
+  if (t->nbucket != nbucket) {
+    pthread_mutex_unlock(&t->growlock);
+    return;
+  }
+  nseg = t->nslot / HOP_SEGMENT + 1;
+  for (i = 0; i < nseg; i++) {
+    pthread_mutex_lock(t->locks + i);
+  }
+  HT_(alloc)(&n, 2 * nbucket);
+  pthread_mutex_init(&n.stashlock, NULL);
+  n.nfail = 0;
+  for (i = 0; i < t->nslot; i++) {
+    if (t->slots[i].used) {
+      HT_(insert)(&n, HT_(bucket)(&n, t->slots[i].key), t->slots[i].key, t->slots[i].value, NULL);
+    }
+  }
+  for (s = t->stash; s != NULL; s = s->next) {
+    HT_(insert)(&n, HT_(bucket)(&n, s->e.key), s->e.key, s->e.value, NULL);
+  }
+  pthread_mutex_destroy(&n.stashlock);
+
+  o = malloc(sizeof(struct HT_(old)));
+  assert(o);
+  o->nslot = t->nslot;
+  o->slots = t->slots;
+  o->locks = t->locks;
+  o->seq = t->seq;
+  o->stash = t->stash;
+  o->next = t->old;
+  t->old = o;
+  // the larger arrays go in before the larger nbucket, so that no torn
+  // read indexes the old ones with it
+  __sync_fetch_and_add(&t->gen, 1);
+  t->nslot = n.nslot;
+  t->slots = n.slots;
+  t->seq = n.seq;
+  t->locks = n.locks;
+  t->stash = n.stash;
+  t->nstash = n.nstash;
+  __atomic_store_n(&t->nbucket, n.nbucket, __ATOMIC_RELEASE);
+  __sync_fetch_and_add(&t->gen, 1);
+  t->nfail += n.nfail;
+  t->ngrow++;
+  for (i = 0; i < nseg; i++) {
+    pthread_mutex_unlock(o->locks + i);
+  }
+  pthread_mutex_unlock(&t->growlock);
+}
+
+// Insert, or overwrite the value if the key is present.
+static void
+HT_(put)(struct HT_NAME *t, HT_KEY key, HT_VALUE value)
+{
+  pthread_mutex_t *locks;
+  long nbucket, home, lo, held, b;
+  struct HT_(entry) *e;
+  uint32_t hop;
+  int i, grow;
+
+  // a resize may swap the arrays until we hold one of their locks
+  for (;;) {
+    nbucket = __atomic_load_n(&t->nbucket, __ATOMIC_ACQUIRE);
+    locks = __atomic_load_n(&t->locks, __ATOMIC_ACQUIRE);
+    home = HT_HASH(key) % nbucket;
+    lo = home - HOP_H + 1 > 0 ? home - HOP_H + 1 : 0;
+    held = lo / HOP_SEGMENT;
+    pthread_mutex_lock(locks + held);
+    if (t->locks == locks && t->nbucket == nbucket) break;
+    pthread_mutex_unlock(locks + held);
+  }
+  HT_(reach)(t, home, &held);
+  hop = t->slots[home].hop;
+  for (; hop & ~HOP_STASHED; hop &= hop - 1) {
+    i = __builtin_ctz(hop);
+    if (HT_EQ(t->slots[home + i].key, key)) {
+      t->slots[home + i].value = value;
+      goto out;
+    }
+  }
+  if (hop & HOP_STASHED && (e = HT_(stashget)(t, key)) != 0) {
+    e->value = value;
+    goto out;
+  }
+  HT_(insert)(t, home, HT_INTERN(key), value, &held);
+out:
+  grow = t->nstash > nbucket / HOP_GROW;
+  for (b = lo / HOP_SEGMENT; b <= held; b++) {
+    pthread_mutex_unlock(t->locks + b);
+  }
+  if (grow) HT_(grow)(t, nbucket);
+}
+
+static struct HT_(entry) *
+HT_(get)(struct HT_NAME *t, HT_KEY key)
+{
+  struct HT_(entry) *slots, *e;
+  volatile unsigned *seq;
+  unsigned g, s;
+  uint32_t hop;
+  long home;
+
+  for (;;) {
+    while ((g = __atomic_load_n(&t->gen, __ATOMIC_ACQUIRE)) & 1) ;
+    home = HT_HASH(key) % __atomic_load_n(&t->nbucket, __ATOMIC_ACQUIRE);
+    slots = t->slots;
+    seq = &t->seq[home / HOP_SEGMENT];
+    while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) ;
+    e = 0;
+    hop = __atomic_load_n(&slots[home].hop, __ATOMIC_ACQUIRE);
+    for (; hop & ~HOP_STASHED; hop &= hop - 1) {
+      struct HT_(entry) *c = &slots[home + __builtin_ctz(hop)];
+      if (HT_EQ(c->key, key)) {
+        e = c;
+        break;
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(seq, __ATOMIC_RELAXED) != s) continue;
+    if (e == 0 && hop & HOP_STASHED) e = HT_(stashget)(t, key);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&t->gen, __ATOMIC_RELAXED) != g) continue;
+    return e;
+  }
+}
+
+static size_t
+HT_(arraybytes)(long nslot)
+{
+  long nseg = nslot / HOP_SEGMENT + 1;
+  return sizeof(struct HT_(entry)) * nslot +
+    (sizeof(pthread_mutex_t) + sizeof(unsigned)) * nseg;
+}
+
+// The live arrays and overflow list; the retired ones are reported apart.
+static size_t
+HT_(bytes)(struct HT_NAME *t)
+{
+  return HT_(arraybytes)(t->nslot) + sizeof(struct HT_(stash)) * t->nstash;
+}
+
+static void
+HT_(report)(struct HT_NAME *t, long n)
+{
+  struct HT_(old) *o;
+  long b, used = 0, sum = 0;
+  size_t old = 0;
+  uint32_t hop;
+  int max = 0, d;
+
+  for (b = 0; b < t->nbucket; b++) {
+    for (hop = t->slots[b].hop & ~HOP_STASHED; hop; hop &= hop - 1) {
+      d = __builtin_ctz(hop);
+      used++;
+      sum += d;
+      if (d > max) max = d;
+    }
+  }
+  for (o = t->old; o != NULL; o = o->next) {
+    old += HT_(arraybytes)(o->nslot);
+  }
+  printf("hopscotch: load factor %.2f, distance from home max %d mean %.2f, "
+         "%ld overflowed, %.1f bytes/key\n",
+         (double) (used + t->nstash) / t->nbucket, max, used ? (double) sum / used : 0.0,
+         t->nstash, (double) HT_(bytes)(t) / n);
+  printf("hopscotch: %ld inserts failed to hop into range, %d resizes to %ld home slots, "
+         "%.1f bytes/key left in retired arrays\n",
+         t->nfail, t->ngrow, t->nbucket, (double) old / n);
+}
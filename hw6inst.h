@@ -0,0 +1,83 @@
+// Instantiate every hw6 table backend, with its benchmark, for one key
+// type. Define before including:
+//   KT_NAME        prefix; the backends are KT_NAME (chained), KT_NAMEc
+//                  (chained, compact), KT_NAMEr (Robin Hood), KT_NAMEs
+//                  (split-ordered), KT_NAMEh (hopscotch), KT_NAMEk
+//                  (CLOCK cache) and KT_NAMEm (shared memory)
+//   KT_KEY, KT_VALUE, KT_HASH(k), KT_EQ(a, b)
+//                  as HT_KEY etc. in hw6table.h
+//   KT_RANDOM()    a fresh random key
+//   KT_VALUEOF(n)  the value thread n stores
+// and optionally:
+//   KT_INTERN(k)   copy of k for the table to keep, as HT_INTERN
+//   KT_RESET()     frees every KT_INTERN copy, once their table is gone
+//
+// hw6backend.h instantiates each backend along with what works over it;
+// a new backend is one more block below, and a new header for every
+// backend one more include there. The KT_ parameters are #undef'd at the
+// end.
+
+#ifndef HW6INST_H
+#define HW6INST_H
+
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+
+// keytypes[] entries for every backend of prefix p, key type name k
+#define BACKENDS(p, k) \
+  { k, "chain", p##_run }, \
+  { k, "compact", p##c_run }, \
+  { k, "robin", p##r_run }, \
+  { k, "split", p##s_run }, \
+  { k, "hopscotch", p##h_run }, \
+  { k, "cache", p##k_run }, \
+  { k, "shm", p##m_run },
+
+#endif
+
+#ifndef KT_INTERN
+#define KT_INTERN(k) (k)
+#endif
+#ifndef KT_RESET
+#define KT_RESET()
+#endif
+
+#define HT_NAME KT_NAME
+#define HT_BACKEND "hw6table.h"
+#include "hw6backend.h"
+
+#define HT_NAME HT_CAT(KT_NAME, c)
+#define HT_BACKEND "hw6table.h"
+#define HT_COMPACT
+#include "hw6backend.h"
+
+#define HT_NAME HT_CAT(KT_NAME, r)
+#define HT_BACKEND "hw6robin.h"
+#include "hw6backend.h"
+
+#define HT_NAME HT_CAT(KT_NAME, s)
+#define HT_BACKEND "hw6split.h"
+#include "hw6backend.h"
+
+#define HT_NAME HT_CAT(KT_NAME, h)
+#define HT_BACKEND "hw6hop.h"
+#include "hw6backend.h"
+
+#define HT_NAME HT_CAT(KT_NAME, k)
+#define HT_BACKEND "hw6cache.h"
+#include "hw6backend.h"
+
+#define HT_NAME HT_CAT(KT_NAME, m)
+#define HT_BACKEND "hw6shm.h"
+#include "hw6backend.h"
+
+#undef KT_NAME
+#undef KT_KEY
+#undef KT_VALUE
+#undef KT_HASH
+#undef KT_EQ
+#undef KT_RANDOM
+#undef KT_VALUEOF
+#undef KT_INTERN
+#undef KT_RESET
+#undef KT_KEYS
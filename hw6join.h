@@ -0,0 +1,304 @@
+// Parallel equi-joins of two relations, R and S, with the chained table
+// (hw6table.h): include right after it, with the same HT_ parameters. A
+// relation is an array of keys and an array with a value per key.
+//
+// HT_(join) with bits 0 is the no-partitioning join: threads put their
+// slices of R into one shared table with put(), and once all have, probe
+// it with their slices of S. With bits > 0 it is the radix join: threads
+// first partition both relations 2^bits ways by key hash, as bulk_load
+// does, and then each takes whole partitions and joins them alone. The
+// table over a partition of R is small enough to stay in cache; it
+// chains the partition's own tuples by 32-bit index, as the compact
+// layout does, and takes no locks since one thread owns it.
+//
+// Every R and S tuple with equal keys make a match; thread i appends its
+// matches to out[i]. The two steps are timed with now() from hw6.c.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef HW6JOIN_H
+#define HW6JOIN_H
+
+#define JOIN_PARTKEYS 2048    // R tuples per partition the radix join aims at
+#define JOIN_MAXBITS 14       // more partitions than pages the TLB maps
+
+// Radix bits for a relation R of nr tuples.
+static int
+join_bits(long nr)
+{
+  int bits = 1;
+
+  while (bits < JOIN_MAXBITS && (nr >> bits) > JOIN_PARTKEYS) bits++;
+  return bits;
+}
+
+#endif
+
+struct HT_(match) {
+  HT_KEY key;
+  HT_VALUE r;
+  HT_VALUE s;
+};
+
+struct HT_(joinout) {
+  struct HT_(match) *m;
+  long n;
+  long cap;
+};
+
+// Grow o to room for cap matches, all of it faulted in.
+static void
+HT_(joinout_reserve)(struct HT_(joinout) *o, long cap)
+{
+  if (cap <= o->cap) return;
+  o->m = realloc(o->m, sizeof(struct HT_(match)) * cap);
+  assert(o->m);
+  memset(o->m + o->cap, 0, sizeof(struct HT_(match)) * (cap - o->cap));
+  o->cap = cap;
+}
+
+static inline void
+HT_(emit)(struct HT_(joinout) *o, HT_KEY key, HT_VALUE r, HT_VALUE s)
+{
+  if (o->n == o->cap) HT_(joinout_reserve)(o, o->cap ? 2 * o->cap : 1024);
+  o->m[o->n].key = key;
+  o->m[o->n].r = r;
+  o->m[o->n].s = s;
+  o->n++;
+}
+
+struct HT_(join) {
+  struct HT_NAME t;           // the no-partitioning join's table
+  HT_KEY *rk;
+  HT_VALUE *rv;
+  long nr;
+  HT_KEY *sk;
+  HT_VALUE *sv;
+  long ns;
+  int nthreads;
+  int bits;
+  int phase;
+  long *rhist, *shist;        // nthreads x npart counts, then offsets
+  long *rstart, *sstart;      // npart+1 partition boundaries
+  HT_KEY *prk;                // R and S, partitioned
+  HT_VALUE *prv;
+  HT_KEY *psk;
+  HT_VALUE *psv;
+  struct HT_(joinout) *out;
+  volatile int nextpart;
+};
+
+struct HT_(joinworker) {
+  struct HT_(join) *j;
+  long id;
+};
+
+static inline int
+HT_(joinpart)(struct HT_(join) *j, HT_KEY key)
+{
+  return bloom_mix(HT_HASH(key)) >> (64 - j->bits);
+}
+
+// Join partition p of R and S, using head and next as the table.
+static void
+HT_(joinpartition)(struct HT_(join) *j, int p, struct HT_(joinout) *o,
+                   uint32_t **head, uint32_t **next, long *cap)
+{
+  long r0 = j->rstart[p], nr = j->rstart[p+1] - r0, i;
+  uint32_t mask = 0, b, l;
+
+  if (nr == 0) return;
+  while (mask + 1 < nr) mask = 2 * mask + 1;
+  if (mask + 1 > *cap) {
+    *cap = mask + 1;
+    *head = realloc(*head, sizeof(uint32_t) * *cap);
+    *next = realloc(*next, sizeof(uint32_t) * *cap);
+    assert(*head && *next);
+  }
+  memset(*head, 0, sizeof(uint32_t) * (mask + 1));
+  for (i = 0; i < nr; i++) {
+    b = bloom_mix(HT_HASH(j->prk[r0 + i])) & mask;
+    (*next)[i] = (*head)[b];
+    (*head)[b] = i + 1;
+  }
+  for (i = j->sstart[p]; i < j->sstart[p+1]; i++) {
+    b = bloom_mix(HT_HASH(j->psk[i])) & mask;
+    for (l = (*head)[b]; l != 0; l = (*next)[l - 1]) {
+      if (HT_EQ(j->prk[r0 + l - 1], j->psk[i])) HT_(emit)(o, j->psk[i], j->prv[r0 + l - 1], j->psv[i]);
+    }
+  }
+}
+
+static void *
+HT_(jointhread)(void *xa)
+{
+  struct HT_(joinworker) *w = xa;
+  struct HT_(join) *j = w->j;
+  struct HT_(joinout) *o = &j->out[w->id];
+  struct HT_NAME *t = &j->t;
+  struct HT_(entry) *e;
+  long rlo = j->nr * w->id / j->nthreads, rhi = j->nr * (w->id + 1) / j->nthreads;
+  long slo = j->ns * w->id / j->nthreads, shi = j->ns * (w->id + 1) / j->nthreads;
+  long npart = 1L << j->bits;
+  long *rh = j->rhist + w->id * npart, *sh = j->shist + w->id * npart;
+  uint32_t *head = NULL, *next = NULL;
+  long i, k, cap = 0;
+  int p;
+
+  switch (j->phase) {
+  case 0:  // build the shared table
+    for (i = rlo; i < rhi; i++) {
+      HT_(put)(t, j->rk[i], j->rv[i]);
+    }
+    break;
+  case 1:  // probe it
+    for (i = slo; i < shi; i++) {
+      for (e = HT_(deref)(t, t->table[HT_(bucket)(t, j->sk[i])]); e != 0; e = HT_(deref)(t, e->next)) {
+        if (HT_EQ(e->key, j->sk[i])) HT_(emit)(o, j->sk[i], e->value, j->sv[i]);
+      }
+    }
+    break;
+  case 2:  // histogram this thread's slices by partition
+    for (i = rlo; i < rhi; i++) {
+      rh[HT_(joinpart)(j, j->rk[i])]++;
+    }
+    for (i = slo; i < shi; i++) {
+      sh[HT_(joinpart)(j, j->sk[i])]++;
+    }
+    break;
+  case 3:  // scatter them
+    for (i = rlo; i < rhi; i++) {
+      k = rh[HT_(joinpart)(j, j->rk[i])]++;
+      j->prk[k] = j->rk[i];
+      j->prv[k] = j->rv[i];
+    }
+    for (i = slo; i < shi; i++) {
+      k = sh[HT_(joinpart)(j, j->sk[i])]++;
+      j->psk[k] = j->sk[i];
+      j->psv[k] = j->sv[i];
+    }
+    break;
+  case 4:  // join whole partitions
+    while ((p = __sync_fetch_and_add(&j->nextpart, 1)) < npart) {
+      HT_(joinpartition)(j, p, o, &head, &next, &cap);
+    }
+    free(head);
+    free(next);
+    break;
+  }
+  return NULL;
+}
+
+static void
+HT_(joinphase)(struct HT_(join) *j, int phase)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * j->nthreads);
+  struct HT_(joinworker) *w = malloc(sizeof(*w) * j->nthreads);
+  void *value;
+  long i;
+
+  assert(tha && w);
+  j->phase = phase;
+  for (i = 0; i < j->nthreads; i++) {
+    w[i].j = j;
+    w[i].id = i;
+    assert(pthread_create(&tha[i], NULL, HT_(jointhread), &w[i]) == 0);
+  }
+  for (i = 0; i < j->nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+  free(w);
+  free(tha);
+}
+
+// Partition-major, thread-order offsets from the counts in hist; start
+// gets the partition boundaries.
+static void
+HT_(joinoffsets)(long *hist, long *start, long npart, int nthreads)
+{
+  long off = 0, c, p;
+  int i;
+
+  for (p = 0; p < npart; p++) {
+    start[p] = off;
+    for (i = 0; i < nthreads; i++) {
+      c = hist[i * npart + p];
+      hist[i * npart + p] = off;
+      off += c;
+    }
+  }
+  start[npart] = off;
+}
+
+// Join R (rk, rv, nr) with S (sk, sv, ns) on nthreads threads, radix
+// partitioned 2^bits ways, or not at all if bits is 0. Thread i's matches
+// are appended to out[i]. Returns the number of matches; time[0] gets the
+// time taken to build or partition, time[1] to probe or join.
+static long
+HT_(join)(HT_KEY *rk, HT_VALUE *rv, long nr, HT_KEY *sk, HT_VALUE *sv, long ns,
+          int nthreads, int bits, struct HT_(joinout) *out, double *time)
+{
+  struct HT_(join) j;
+  long npart = 1L << bits, n = 0;
+  double t2, t1, t0;
+  int i;
+
+  assert(bits >= 0 && bits <= JOIN_MAXBITS && nr < UINT32_MAX);
+  memset(&j, 0, sizeof(j));
+  j.rk = rk;
+  j.rv = rv;
+  j.nr = nr;
+  j.sk = sk;
+  j.sv = sv;
+  j.ns = ns;
+  j.nthreads = nthreads;
+  j.bits = bits;
+  j.out = out;
+  for (i = 0; i < nthreads; i++) {
+    n -= out[i].n;
+  }
+  t0 = now();
+  if (bits == 0) {
+    HT_(init)(&j.t, nr > 0 ? nr : 1, nr + (long) nthreads * HT_POOLCHUNK);
+    HT_(joinphase)(&j, 0);
+    t1 = now();
+    HT_(joinphase)(&j, 1);
+    t2 = now();
+    HT_(destroy)(&j.t);
+  } else {
+    j.rhist = calloc(nthreads * npart, sizeof(long));
+    j.shist = calloc(nthreads * npart, sizeof(long));
+    j.rstart = malloc(sizeof(long) * (npart + 1));
+    j.sstart = malloc(sizeof(long) * (npart + 1));
+    j.prk = malloc(sizeof(HT_KEY) * (nr + 1));
+    j.prv = malloc(sizeof(HT_VALUE) * (nr + 1));
+    j.psk = malloc(sizeof(HT_KEY) * (ns + 1));
+    j.psv = malloc(sizeof(HT_VALUE) * (ns + 1));
+    assert(j.rhist && j.shist && j.rstart && j.sstart && j.prk && j.prv && j.psk && j.psv);
+    HT_(joinphase)(&j, 2);
+    HT_(joinoffsets)(j.rhist, j.rstart, npart, nthreads);
+    HT_(joinoffsets)(j.shist, j.sstart, npart, nthreads);
+    HT_(joinphase)(&j, 3);
+    t1 = now();
+    HT_(joinphase)(&j, 4);
+    t2 = now();
+    free(j.rhist);
+    free(j.shist);
+    free(j.rstart);
+    free(j.sstart);
+    free(j.prk);
+    free(j.prv);
+    free(j.psk);
+    free(j.psv);
+  }
+  time[0] = t1-t0;
+  time[1] = t2-t1;
+  for (i = 0; i < nthreads; i++) {
+    n += out[i].n;
+  }
+  return n;
+}
@@ -0,0 +1,273 @@
+// Asynchronous submission/completion rings over any hw6 table backend,
+// in the style of io_uring: include after the table header, with the
+// same HT_ parameters.
+//
+// Each client thread owns a submission ring and a completion ring, both
+// single-producer/single-consumer. It queues puts and gets with
+// HT_(sq_push), makes them visible with HT_(sq_submit), and later takes
+// their results, with tags of its choosing, from HT_(cq_reap); it never
+// touches the table or its locks itself. A pool of worker threads serves
+// the clients, worker w those with c % nworker == w. A worker takes up to
+// RING_BATCH requests from its clients' rings at once, runs them grouped
+// by bucket range so the batch sweeps the table in one direction, and
+// then publishes each client's completions with a single store.
+//
+// A client keeps at most depth requests in flight, so neither of its
+// rings can overflow, and a submission slot is free again once its
+// completion has been reaped.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "hw6hash.h"
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HW6RING_H
+#define HW6RING_H
+
+#define RING_BATCH 256        // requests a worker runs at once
+#define RING_BINS 64          // bucket ranges a batch is grouped into
+
+enum { RING_PUT, RING_GET };
+
+#endif
+
+struct HT_(sqe) {
+  int op;
+  HT_KEY key;
+  HT_VALUE value;
+  uint64_t tag;
+};
+
+struct HT_(cqe) {
+  uint64_t tag;
+  struct HT_(entry) *e;       // what a get found
+};
+
+struct HT_(ringclient) {
+  // the client's side
+  volatile long sqtail __attribute__((aligned(64)));  // published submissions
+  long sqnext;                // next submission slot
+  long cqhead;                // completions reaped
+  // the worker's side
+  long sqhead __attribute__((aligned(64)));           // submissions taken
+  long cqnext;                // next completion slot
+  volatile long cqtail;       // published completions
+  struct HT_(sqe) *sq;
+  struct HT_(cqe) *cq;
+};
+
+struct HT_(uring);
+
+struct HT_(ringworker) {
+  struct HT_(uring) *u;
+  int id;
+  pthread_t thread;
+};
+
+struct HT_(uring) {
+  struct HT_NAME *t;
+  long nbucket;
+  int nclient;
+  int nworker;
+  long depth;                 // requests a client may have in flight
+  long mask;                  // ring slots - 1
+  struct HT_(ringclient) *c;
+  struct HT_(ringworker) *w;
+  volatile int stop;
+};
+
+static void *
+HT_(ringthread)(void *xa)
+{
+  struct HT_(ringworker) *w = xa;
+  struct HT_(uring) *u = w->u;
+  struct HT_(sqe) *batch[RING_BATCH];
+  struct HT_(entry) *res[RING_BATCH];
+  uint64_t h[RING_BATCH];
+  uint32_t bk[RING_BATCH];
+  short owner[RING_BATCH], order[RING_BATCH];
+  int count[RING_BINS + 1];
+  struct HT_(ringclient) *cl;
+  long tail, m;
+  int n, i, c, spin = 0;
+
+  while (!u->stop) {
+    // gather what the clients have submitted
+    n = 0;
+    for (c = w->id; c < u->nclient && n < RING_BATCH; c += u->nworker) {
+      cl = &u->c[c];
+      tail = __atomic_load_n(&cl->sqtail, __ATOMIC_ACQUIRE);
+      for (m = cl->sqhead; m < tail && n < RING_BATCH; m++, n++) {
+        batch[n] = &cl->sq[m & u->mask];
+        owner[n] = c;
+      }
+    }
+    if (n == 0) {
+      if (++spin % 64 == 0) sched_yield();
+      continue;
+    }
+    // group by bucket range, keeping each range in submission order
+    for (i = 0; i < n; i++) {
+      h[i] = HT_HASH(batch[i]->key);
+    }
+    hash_reduce(h, n, u->nbucket, bk);
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+      bk[i] = (uint64_t) bk[i] * RING_BINS / u->nbucket;
+      count[bk[i] + 1]++;
+    }
+    for (i = 0; i < RING_BINS; i++) {
+      count[i + 1] += count[i];
+    }
+    for (i = 0; i < n; i++) {
+      order[count[bk[i]]++] = i;
+    }
+    for (i = 0; i < n; i++) {
+      struct HT_(sqe) *s = batch[order[i]];
+      if (s->op == RING_PUT) {
+        HT_(put)(u->t, s->key, s->value);
+        res[order[i]] = 0;
+      } else {
+        res[order[i]] = HT_(get)(u->t, s->key);
+      }
+    }
+    // complete in submission order, one publication per client
+    for (i = 0; i < n; i++) {
+      cl = &u->c[owner[i]];
+      cl->cq[cl->cqnext & u->mask].tag = batch[i]->tag;
+      cl->cq[cl->cqnext & u->mask].e = res[i];
+      cl->cqnext++;
+      cl->sqhead++;
+    }
+    for (c = w->id; c < u->nclient; c += u->nworker) {
+      cl = &u->c[c];
+      if (cl->cqnext != cl->cqtail) __atomic_store_n(&cl->cqtail, cl->cqnext, __ATOMIC_RELEASE);
+    }
+  }
+  return NULL;
+}
+
+// Rings for nclient clients of t, whose buckets number nbucket, each with
+// up to depth requests in flight, served by nworker new worker threads.
+static void
+HT_(uring_init)(struct HT_(uring) *u, struct HT_NAME *t, long nbucket, int nclient,
+                int nworker, long depth)
+{
+  long size = 1;
+  int i;
+
+  assert(depth > 0 && nclient > 0 && nworker > 0 && nbucket < (1L << 31));
+  while (size < depth) size *= 2;
+  u->t = t;
+  u->nbucket = nbucket;
+  u->nclient = nclient;
+  u->nworker = nworker;
+  u->depth = depth;
+  u->mask = size - 1;
+  u->stop = 0;
+  u->c = aligned_alloc(64, sizeof(struct HT_(ringclient)) * nclient);
+  u->w = malloc(sizeof(struct HT_(ringworker)) * nworker);
+  assert(u->c && u->w);
+  memset(u->c, 0, sizeof(struct HT_(ringclient)) * nclient);
+  for (i = 0; i < nclient; i++) {
+    u->c[i].sq = malloc(sizeof(struct HT_(sqe)) * size);
+    u->c[i].cq = malloc(sizeof(struct HT_(cqe)) * size);
+    assert(u->c[i].sq && u->c[i].cq);
+  }
+  for (i = 0; i < nworker; i++) {
+    u->w[i].u = u;
+    u->w[i].id = i;
+    assert(pthread_create(&u->w[i].thread, NULL, HT_(ringthread), &u->w[i]) == 0);
+  }
+}
+
+// Stop the workers and free the rings; nothing may be in flight.
+static void
+HT_(uring_free)(struct HT_(uring) *u)
+{
+  void *value;
+  int i;
+
+  u->stop = 1;
+  for (i = 0; i < u->nworker; i++) {
+    assert(pthread_join(u->w[i].thread, &value) == 0);
+  }
+  for (i = 0; i < u->nclient; i++) {
+    free(u->c[i].sq);
+    free(u->c[i].cq);
+  }
+  free(u->c);
+  free(u->w);
+}
+
+// Queue a request from client c; 0 if c already has depth in flight.
+static inline int
+HT_(sq_push)(struct HT_(uring) *u, int c, int op, HT_KEY key, HT_VALUE value, uint64_t tag)
+{
+  struct HT_(ringclient) *cl = &u->c[c];
+  struct HT_(sqe) *s;
+
+  if (cl->sqnext - cl->cqhead == u->depth) return 0;
+  s = &cl->sq[cl->sqnext++ & u->mask];
+  s->op = op;
+  s->key = key;
+  s->value = value;
+  s->tag = tag;
+  return 1;
+}
+
+// Hand client c's queued requests to its worker.
+static inline void
+HT_(sq_submit)(struct HT_(uring) *u, int c)
+{
+  struct HT_(ringclient) *cl = &u->c[c];
+
+  if (cl->sqnext != cl->sqtail) __atomic_store_n(&cl->sqtail, cl->sqnext, __ATOMIC_RELEASE);
+}
+
+// Take up to max of client c's completions into out; returns how many.
+static inline int
+HT_(cq_reap)(struct HT_(uring) *u, int c, struct HT_(cqe) *out, int max)
+{
+  struct HT_(ringclient) *cl = &u->c[c];
+  long tail = __atomic_load_n(&cl->cqtail, __ATOMIC_ACQUIRE);
+  int n = tail - cl->cqhead < max ? tail - cl->cqhead : max, i;
+
+  for (i = 0; i < n; i++) {
+    out[i] = cl->cq[(cl->cqhead + i) & u->mask];
+  }
+  cl->cqhead += n;
+  return n;
+}
+
+// Client c puts keys[0..n) with vals[0..n), or gets them (vals NULL),
+// keeping the ring full. Returns the number of gets that missed.
+static long
+HT_(uring_run)(struct HT_(uring) *u, int c, int op, HT_KEY *keys, HT_VALUE *vals, long n)
+{
+  struct HT_(cqe) done[RING_BATCH];
+  long i = 0, ndone = 0, missing = 0;
+  int got, j, spin = 0;
+
+  while (ndone < n) {
+    while (i < n && HT_(sq_push)(u, c, op, keys[i], vals ? vals[i] : (HT_VALUE) 0, i)) i++;
+    HT_(sq_submit)(u, c);
+    got = HT_(cq_reap)(u, c, done, RING_BATCH);
+    for (j = 0; j < got; j++) {
+      if (op == RING_GET && done[j].e == 0) missing++;
+    }
+    ndone += got;
+    if (got == 0 && ++spin % 64 == 0) sched_yield();
+  }
+  return missing;
+}
@@ -0,0 +1,207 @@
+// Template header for a Robin Hood open-addressing backend, with the same
+// parameters and put/get interface as hw6table.h.
+//
+// Entries live in one slot array. An insert walks forward from the key's
+// home slot and takes the slot of any entry closer to its own home than
+// the new key is, carrying the evicted entry on; this keeps probe lengths
+// short and even, so the table can run much fuller than chaining. Delete
+// shifts the following run back one slot, so there are no tombstones.
+//
+// Writers lock the HT_SEGMENT-slot segments they touch, in ascending
+// order. Probes never wrap: a slack region past the last home slot takes
+// the overflow instead, which keeps the lock order acyclic. As in the
+// chained table, get() takes no lock and is meant for after the puts.
+// Defines HT_ROBIN to tell hw6bench.h.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HT_INTERN
+#define HT_INTERN(k) (k)
+#endif
+
+#ifndef HT_SEGMENT
+#define HT_SEGMENT 64  // slots per writer lock
+#endif
+
+struct HT_(entry) {
+  HT_KEY key;
+  HT_VALUE value;
+  uint16_t psl;             // probe sequence length + 1; 0 if empty
+};
+
+struct HT_NAME {
+  long nbucket;             // home slots
+  long nslot;               // home slots plus overflow slack
+  struct HT_(entry) *slots;
+  pthread_mutex_t *locks;   // one per segment
+};
+
+static void
+HT_(init)(struct HT_NAME *t, long nbucket, long nentry)
+{
+  long i;
+
+  (void) nentry;
+  t->nbucket = nbucket;
+  t->nslot = nbucket + nbucket / 64 + 1024;
+  t->slots = calloc(t->nslot + 1, sizeof(struct HT_(entry)));  // + sentinel
+  t->locks = malloc(sizeof(pthread_mutex_t) * (t->nslot / HT_SEGMENT + 1));
+  assert(t->slots && t->locks);
+  for (i = 0; i <= t->nslot / HT_SEGMENT; i++) {
+    pthread_mutex_init(t->locks + i, NULL);
+  }
+}
+
+static void
+HT_(destroy)(struct HT_NAME *t)
+{
+  long i;
+
+  for (i = 0; i <= t->nslot / HT_SEGMENT; i++) {
+    pthread_mutex_destroy(t->locks + i);
+  }
+  free(t->slots);
+  free(t->locks);
+  t->slots = NULL;
+}
+
+static inline long
+HT_(bucket)(struct HT_NAME *t, HT_KEY key)
+{
+  return HT_HASH(key) % t->nbucket;
+}
+
+// Lock segments up to the one holding slot pos; *held is the highest
+// segment already locked. The sentinel slot at nslot is never written.
+static inline void
+HT_(reach)(struct HT_NAME *t, long pos, long *held)
+{
+  if (pos >= t->nslot) return;
+  while (pos / HT_SEGMENT > *held) {
+    pthread_mutex_lock(t->locks + ++*held);
+  }
+}
+
+static void
+HT_(unlock)(struct HT_NAME *t, long lo, long held)
+{
+  long s;
+
+  for (s = lo / HT_SEGMENT; s <= held; s++) {
+    pthread_mutex_unlock(t->locks + s);
+  }
+}
+
+// Insert, or overwrite the value if the key is present.
+static void
+HT_(put)(struct HT_NAME *t, HT_KEY key, HT_VALUE value)
+{
+  long home = HT_(bucket)(t, key), pos, held = home / HT_SEGMENT;
+  struct HT_(entry) cur = { HT_INTERN(key), value, 1 }, tmp;
+  int swapped = 0;
+
+  pthread_mutex_lock(t->locks + held);
+  for (pos = home; ; pos++, cur.psl++) {
+    struct HT_(entry) *s;
+    assert(pos < t->nslot);
+    HT_(reach)(t, pos, &held);
+    s = &t->slots[pos];
+    if (s->psl == 0) {
+      *s = cur;
+      break;
+    }
+    if (!swapped && s->psl == cur.psl && HT_EQ(s->key, key)) {
+      s->value = value;
+      break;
+    }
+    if (s->psl < cur.psl) {
+      // s is richer than cur: cur takes its slot, s moves on
+      tmp = *s;
+      *s = cur;
+      cur = tmp;
+      swapped = 1;
+    }
+    assert(cur.psl < UINT16_MAX);
+  }
+  HT_(unlock)(t, home, held);
+}
+
+static struct HT_(entry) *
+HT_(get)(struct HT_NAME *t, HT_KEY key)
+{
+  /* no lock is required as every thread is done */
+  long pos = HT_(bucket)(t, key);
+  int psl;
+
+  // once we pass an entry closer to home than we are, key is absent
+  for (psl = 1; t->slots[pos].psl >= psl; pos++, psl++) {
+    if (HT_EQ(t->slots[pos].key, key)) return &t->slots[pos];
+  }
+  return 0;
+}
+
+// Remove key, shifting the rest of its run back one slot. Returns 0 if
+// the key was absent.
+static inline int
+HT_(del)(struct HT_NAME *t, HT_KEY key)
+{
+  long home = HT_(bucket)(t, key), pos, held = home / HT_SEGMENT;
+  int psl, found = 0;
+
+  pthread_mutex_lock(t->locks + held);
+  for (pos = home, psl = 1; t->slots[pos].psl >= psl; pos++, psl++) {
+    if (HT_EQ(t->slots[pos].key, key)) {
+      found = 1;
+      break;
+    }
+    HT_(reach)(t, pos + 1, &held);
+  }
+  if (found) {
+    for (;; pos++) {
+      HT_(reach)(t, pos + 1, &held);
+      if (t->slots[pos+1].psl <= 1) break;
+      t->slots[pos] = t->slots[pos+1];
+      t->slots[pos].psl--;
+    }
+    t->slots[pos].psl = 0;
+  }
+  HT_(unlock)(t, home, held);
+  return found;
+}
+
+static size_t
+HT_(bytes)(struct HT_NAME *t)
+{
+  return sizeof(struct HT_(entry)) * (t->nslot + 1) +
+    sizeof(pthread_mutex_t) * (t->nslot / HT_SEGMENT + 1);
+}
+
+static void
+HT_(report)(struct HT_NAME *t, long n)
+{
+  long pos, used = 0, sum = 0;
+  int max = 0;
+
+  for (pos = 0; pos < t->nslot; pos++) {
+    int psl = t->slots[pos].psl;
+    if (psl == 0) continue;
+    used++;
+    sum += psl - 1;
+    if (psl - 1 > max) max = psl - 1;
+  }
+  printf("robin: load factor %.2f, probe length max %d mean %.2f, %.1f bytes/key\n",
+         (double) used / t->nbucket, max, used ? (double) sum / used : 0.0,
+         (double) HT_(bytes)(t) / n);
+}
+
+#define HT_ROBIN
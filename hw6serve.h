@@ -0,0 +1,523 @@
+// A key-value server for any hw6 table backend over a Unix domain socket,
+// and a load generator for it. Include after the table header, with the
+// same HT_ parameters; keys and values go over the socket as their bytes,
+// so they must not point elsewhere.
+//
+// A client opens with a hello naming its key and value sizes. The server
+// answers with its own and hangs up if they differ. The client then
+// sends packed (op, key, value) requests, and the server answers each,
+// in order, with a packed (status, value). A client may send many
+// requests before reading any answers. A server whose table can't grow
+// has room for a given number of puts; past that it answers puts with
+// SERVE_FULL and leaves the table alone.
+//
+// HT_(sockserve) runs nthreads threads, each with its own epoll loop. Every
+// thread waits on the listening socket too (EPOLLEXCLUSIVE wakes just
+// one), accepts the connections it is woken for and serves them to the
+// end. A thread reads as many requests as have arrived, runs them all,
+// and sends all their answers with one send; if the client isn't reading
+// them, it stops reading from that client until they have gone out. It
+// returns once serve_stop is set, as SIGINT and SIGTERM do.
+//
+// HT_(sockload) has each of nthreads threads connect, put its slice of the
+// keys and then, once every thread has, get them all, with up to depth
+// requests in flight on its connection. It sends without blocking and
+// reads answers whenever they arrive, so a deep window can't leave it
+// and the server both waiting to send. It notes each request's latency,
+// from being queued to its answer arriving.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HW6SERVE_H
+#define HW6SERVE_H
+
+#define SERVE_MAGIC 0x53364857      // "WH6S"
+#define SERVE_BUF 65536             // bytes a connection buffers each way
+#define SERVE_EVENTS 64
+
+enum { SERVE_PUT, SERVE_GET };
+enum { SERVE_ABSENT, SERVE_OK, SERVE_FULL };  // answer status
+
+struct serve_hello {
+  uint32_t magic;
+  uint16_t keysize;
+  uint16_t valuesize;
+};
+
+struct serve_conn {
+  int fd;
+  int hello;                // hello received
+  int blocked;              // waiting for the client to take answers
+  long inlen;
+  long outlen;
+  long outoff;
+  char in[SERVE_BUF];
+  char out[SERVE_BUF];
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void
+serve_onsignal(int sig)
+{
+  (void) sig;
+  serve_stop = 1;
+}
+
+static uint64_t
+serve_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Listen on a fresh socket at path, non-blocking.
+static int
+serve_listen(const char *path)
+{
+  struct sockaddr_un a;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+  assert(fd >= 0 && strlen(path) < sizeof(a.sun_path));
+  memset(&a, 0, sizeof(a));
+  a.sun_family = AF_UNIX;
+  strcpy(a.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr *) &a, sizeof(a)) != 0 || listen(fd, 1024) != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    exit(-1);
+  }
+  return fd;
+}
+
+static int
+serve_connect(const char *path)
+{
+  struct sockaddr_un a;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  assert(fd >= 0 && strlen(path) < sizeof(a.sun_path));
+  memset(&a, 0, sizeof(a));
+  a.sun_family = AF_UNIX;
+  strcpy(a.sun_path, path);
+  if (connect(fd, (struct sockaddr *) &a, sizeof(a)) != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    exit(-1);
+  }
+  return fd;
+}
+
+static void
+serve_sendall(int fd, const void *p, size_t n)
+{
+  ssize_t w;
+
+  for (; n > 0; p = (const char *) p + w, n -= w) {
+    w = send(fd, p, n, MSG_NOSIGNAL);
+    assert(w > 0);
+  }
+}
+
+// Exit with a message if the server hung up or the connection failed.
+static void
+serve_lost(ssize_t r)
+{
+  if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    fprintf(stderr, "lost the connection to the server\n");
+    exit(-1);
+  }
+}
+
+// Send what c has buffered for its client; 0 if the client has gone.
+// Waits for EPOLLOUT, without reading, while the client is behind.
+static int
+serve_flush(int ep, struct serve_conn *c)
+{
+  struct epoll_event ev;
+  ssize_t w;
+
+  while (c->outoff < c->outlen) {
+    w = send(c->fd, c->out + c->outoff, c->outlen - c->outoff, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (w <= 0) return 0;
+    c->outoff += w;
+  }
+  if (c->outoff == c->outlen) c->outoff = c->outlen = 0;
+  if (c->blocked != (c->outlen > 0)) {
+    c->blocked = c->outlen > 0;
+    ev.events = c->blocked ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = c;
+    assert(epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) == 0);
+  }
+  return 1;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+// Sort the n latencies in ns and print their percentiles.
+static void
+serve_percentiles(const char *what, uint64_t *lat, long n)
+{
+  static const double pct[] = { 50, 90, 99, 99.9 };
+  int i;
+
+  if (n == 0) return;
+  qsort(lat, n, sizeof(uint64_t), cmp_u64);
+  printf("%s latency:", what);
+  for (i = 0; i < 4; i++) {
+    printf(" p%g %.1f us,", pct[i], lat[(long) (pct[i] / 100 * (n - 1))] / 1e3);
+  }
+  printf(" max %.1f us\n", lat[n - 1] / 1e3);
+}
+
+#endif
+
+struct HT_(sreq) {
+  uint8_t op;
+  HT_KEY key;
+  HT_VALUE value;
+} __attribute__((packed));
+
+struct HT_(sresp) {
+  uint8_t status;             // SERVE_OK if found or stored
+  HT_VALUE value;
+} __attribute__((packed));
+
+struct HT_(server) {
+  struct HT_NAME *t;
+  int lfd;
+  long nreq;                  // requests served, over all threads
+  int bounded;                // the table can't grow past room more puts
+  long room;
+  long nfull;                 // puts refused for want of room
+};
+
+// Run the requests c has read that its output buffer has room for the
+// answers to.
+static void
+HT_(serve_run)(struct HT_(server) *s, struct serve_conn *c)
+{
+  struct HT_(sreq) *q = (struct HT_(sreq) *) c->in;
+  struct HT_(sresp) *a = (struct HT_(sresp) *) (c->out + c->outlen);
+  long n = c->inlen / sizeof(*q), room = (SERVE_BUF - c->outlen) / sizeof(*a), i;
+  struct HT_(entry) *e;
+
+  if (n > room) n = room;
+  for (i = 0; i < n; i++, q++, a++) {
+    if (q->op == SERVE_PUT) {
+      a->value = q->value;
+      if (s->bounded && __sync_fetch_and_sub(&s->room, 1) <= 0) {
+        a->status = SERVE_FULL;
+        __sync_fetch_and_add(&s->nfull, 1);
+        continue;
+      }
+      HT_(put)(s->t, q->key, q->value);
+      a->status = SERVE_OK;
+    } else {
+      e = HT_(get)(s->t, q->key);
+      a->status = e != 0 ? SERVE_OK : SERVE_ABSENT;
+      if (e) a->value = e->value;
+      else memset(&a->value, 0, sizeof(a->value));
+    }
+  }
+  c->outlen += n * sizeof(*a);
+  c->inlen -= n * sizeof(*q);
+  memmove(c->in, c->in + n * sizeof(*q), c->inlen);
+  __sync_fetch_and_add(&s->nreq, n);
+}
+
+// Read what c's client has sent and serve all of it that c has room
+// to answer; 0 once the client has gone.
+static int
+HT_(serve_read)(struct HT_(server) *s, int ep, struct serve_conn *c)
+{
+  struct serve_hello *h = (struct serve_hello *) c->in;
+  struct serve_hello mine = { SERVE_MAGIC, sizeof(HT_KEY), sizeof(HT_VALUE) };
+  ssize_t r;
+  int ok;
+
+  if (c->inlen < SERVE_BUF) {
+    r = recv(c->fd, c->in + c->inlen, SERVE_BUF - c->inlen, MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) return 0;
+    if (r > 0) c->inlen += r;
+  }
+  if (!c->hello) {
+    if (c->inlen < (long) sizeof(*h)) return 1;
+    ok = memcmp(h, &mine, sizeof(mine)) == 0;
+    memcpy(c->out, &mine, sizeof(mine));
+    c->outlen = sizeof(mine);
+    // a client of another type gets our hello, then the hang-up
+    if (!serve_flush(ep, c) || !ok) return 0;
+    c->hello = 1;
+    c->inlen -= sizeof(*h);
+    memmove(c->in, c->in + sizeof(*h), c->inlen);
+  }
+  do {
+    HT_(serve_run)(s, c);
+    if (!serve_flush(ep, c)) return 0;
+  } while (!c->blocked && c->inlen >= (long) sizeof(struct HT_(sreq)));
+  return 1;
+}
+
+static void *
+HT_(servethread)(void *xa)
+{
+  struct HT_(server) *s = xa;
+  struct epoll_event ev, evs[SERVE_EVENTS];
+  struct serve_conn *c;
+  int ep = epoll_create1(0), n, i, fd;
+
+  assert(ep >= 0);
+  ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  ev.data.ptr = NULL;         // the listening socket
+  assert(epoll_ctl(ep, EPOLL_CTL_ADD, s->lfd, &ev) == 0);
+  while (!serve_stop) {
+    n = epoll_wait(ep, evs, SERVE_EVENTS, 100);
+    for (i = 0; i < n; i++) {
+      c = evs[i].data.ptr;
+      if (c == NULL) {
+        while ((fd = accept(s->lfd, NULL, NULL)) >= 0) {
+          assert(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+          c = malloc(sizeof(*c));
+          assert(c);
+          c->fd = fd;
+          c->hello = c->blocked = 0;
+          c->inlen = c->outlen = c->outoff = 0;
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          assert(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == 0);
+        }
+        continue;
+      }
+      // a blocked connection reads nothing until its answers are out
+      if (c->blocked) {
+        if (!serve_flush(ep, c)) goto gone;
+        if (c->blocked) continue;
+      }
+      if (HT_(serve_read)(s, ep, c)) continue;
+    gone:
+      epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+      close(c->fd);
+      free(c);
+    }
+  }
+  // connections still open when stopped are dropped with the process
+  close(ep);
+  return NULL;
+}
+
+// Serve t on the socket at path with nthreads threads until serve_stop;
+// returns the number of requests served, and *nfull gets the puts
+// refused. room >= 0 bounds the puts t takes, for tables that can't grow.
+static long
+HT_(sockserve)(struct HT_NAME *t, const char *path, int nthreads, long room, long *nfull)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthreads);
+  struct HT_(server) s;
+  void *value;
+  int i;
+
+  assert(tha);
+  s.t = t;
+  s.lfd = serve_listen(path);
+  s.nreq = 0;
+  s.bounded = room >= 0;
+  s.room = room;
+  s.nfull = 0;
+  for (i = 0; i < nthreads; i++) {
+    assert(pthread_create(&tha[i], NULL, HT_(servethread), &s) == 0);
+  }
+  for (i = 0; i < nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+  close(s.lfd);
+  unlink(path);
+  free(tha);
+  *nfull = s.nfull;
+  return s.nreq;
+}
+
+struct HT_(loader) {
+  const char *path;
+  int nthreads;
+  long depth;
+  HT_KEY *keys;
+  HT_VALUE *vals;           // per key, what its put stores
+  long n;
+  volatile int ready;       // threads done putting
+};
+
+struct HT_(loadthread) {
+  struct HT_(loader) *l;
+  long id;
+  double put;               // phase times
+  double get;
+  long missing;
+  long full;                // puts the server refused
+  uint64_t *putlat;
+  uint64_t *getlat;
+};
+
+// Send keys[0..n) as op requests on fd, which is non-blocking, with up
+// to depth in flight, noting each one's latency in lat; returns the
+// number of answers that weren't SERVE_OK.
+static long
+HT_(loadpipe)(int fd, int op, HT_KEY *keys, HT_VALUE *vals, long n, long depth, uint64_t *lat)
+{
+  struct HT_(sreq) *q = malloc(sizeof(*q) * depth);
+  struct HT_(sresp) *a = malloc(sizeof(*a) * depth);
+  uint64_t *sent = malloc(sizeof(uint64_t) * depth), t;
+  long next = 0, done = 0, m, missing = 0, have = 0, qoff = 0, qlen = 0, i;
+  struct pollfd p;
+  ssize_t r;
+
+  assert(q && a && sent);
+  p.fd = fd;
+  while (done < n) {
+    // queue more once the last lot is all sent
+    if (qoff == qlen) {
+      for (m = 0; next < n && next - done < depth; m++, next++) {
+        q[m].op = op;
+        q[m].key = keys[next];
+        q[m].value = vals[next];
+        sent[next % depth] = serve_ns();
+      }
+      qoff = 0;
+      qlen = sizeof(*q) * m;
+    }
+    p.events = POLLIN | (qoff < qlen ? POLLOUT : 0);
+    if (poll(&p, 1, -1) < 0) {
+      assert(errno == EINTR);
+      continue;
+    }
+    if (p.revents & POLLOUT) {
+      r = send(fd, (char *) q + qoff, qlen - qoff, MSG_NOSIGNAL);
+      serve_lost(r);
+      if (r > 0) qoff += r;
+    }
+    if (!(p.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+    r = recv(fd, (char *) a + have, sizeof(*a) * depth - have, 0);
+    serve_lost(r);
+    if (r < 0) continue;
+    have += r;
+    t = serve_ns();
+    for (i = 0; i < have / (long) sizeof(*a); i++, done++) {
+      lat[done] = t - sent[done % depth];
+      if (a[i].status != SERVE_OK) missing++;
+    }
+    memmove(a, (char *) a + i * sizeof(*a), have - i * sizeof(*a));
+    have -= i * sizeof(*a);
+  }
+  free(q);
+  free(a);
+  free(sent);
+  return missing;
+}
+
+static void *
+HT_(loadthread)(void *xa)
+{
+  struct HT_(loadthread) *w = xa;
+  struct HT_(loader) *l = w->l;
+  struct serve_hello h = { SERVE_MAGIC, sizeof(HT_KEY), sizeof(HT_VALUE) };
+  long lo = l->n * w->id / l->nthreads, hi = l->n * (w->id + 1) / l->nthreads;
+  struct serve_hello theirs;
+  int fd = serve_connect(l->path);
+  size_t got;
+  ssize_t r;
+  double t0;
+
+  serve_sendall(fd, &h, sizeof(h));
+  for (got = 0; got < sizeof(theirs); got += r) {
+    r = recv(fd, (char *) &theirs + got, sizeof(theirs) - got, 0);
+    serve_lost(r);
+  }
+  if (memcmp(&h, &theirs, sizeof(h)) != 0) {
+    fprintf(stderr, "%s: the server holds %d-byte keys and %d-byte values, not %d and %d\n",
+            l->path, theirs.keysize, theirs.valuesize, h.keysize, h.valuesize);
+    exit(-1);
+  }
+  assert(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+  t0 = now();
+  w->full = HT_(loadpipe)(fd, SERVE_PUT, l->keys + lo, l->vals + lo, hi - lo, l->depth, w->putlat);
+  w->put = now() - t0;
+  __sync_fetch_and_add(&l->ready, 1);
+  while (l->ready < l->nthreads) ;
+  t0 = now();
+  w->missing = HT_(loadpipe)(fd, SERVE_GET, l->keys, l->vals, l->n, l->depth, w->getlat);
+  w->get = now() - t0;
+  close(fd);
+  return NULL;
+}
+
+// Load the server at path from nthreads connections: puts of keys[0..n)
+// with values vals, then gets of them all from every connection. Prints
+// each phase's throughput and latency percentiles; returns the number of
+// gets that missed.
+static long
+HT_(sockload)(const char *path, int nthreads, long depth, HT_KEY *keys, HT_VALUE *vals, long n)
+{
+  struct HT_(loader) l = { path, nthreads, depth, keys, vals, n, 0 };
+  struct HT_(loadthread) *w = calloc(nthreads, sizeof(*w));
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthreads);
+  uint64_t *putlat = malloc(sizeof(uint64_t) * n);
+  uint64_t *getlat = malloc(sizeof(uint64_t) * n * nthreads);
+  double put = 0, get = 0;
+  long missing = 0, full = 0, i;
+  void *value;
+
+  assert(w && tha && putlat && getlat);
+  for (i = 0; i < nthreads; i++) {
+    w[i].l = &l;
+    w[i].id = i;
+    w[i].putlat = putlat + n * i / nthreads;
+    w[i].getlat = getlat + n * i;
+    assert(pthread_create(&tha[i], NULL, HT_(loadthread), &w[i]) == 0);
+  }
+  for (i = 0; i < nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+    if (w[i].put > put) put = w[i].put;
+    if (w[i].get > get) get = w[i].get;
+    missing += w[i].missing;
+    full += w[i].full;
+  }
+  printf("load: %d connections, %ld requests in flight each\n", nthreads, depth);
+  printf("load: put throughput = %.0f puts/s, %ld refused as the server was full\n", n / put, full);
+  serve_percentiles("load: put", putlat, n);
+  printf("load: get throughput = %.0f lookups/s, %ld keys missing\n", n * nthreads / get, missing);
+  serve_percentiles("load: get", getlat, n * nthreads);
+  free(w);
+  free(tha);
+  free(putlat);
+  free(getlat);
+  return missing;
+}
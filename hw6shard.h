@@ -0,0 +1,196 @@
+// Template header for shard-per-thread delegation over the chained table
+// (hw6table.h): include right after it, with the same HT_ parameters.
+//
+// Thread i of nshard owns the i-th range of buckets and is the only one
+// that touches them, so it inserts and looks up with no lock and its
+// buckets stay in its own cache. A key owned by another thread travels
+// to the owner as a request on a single-producer/single-consumer ring,
+// one per (client, owner) pair, and its answer comes back on the reverse
+// ring. Both sides publish their ring index once per batch rather than
+// per message, so the shared cache lines change hands once per batch.
+//
+// Every thread is client and server at once: HT_(deleg_run) issues its
+// own operations while serving the requests sent to it, and returns once
+// every thread has finished the same call, so that it has served them
+// all. Defines HT_DELEGATE to tell hw6bench.h.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#ifndef HW6SHARD_H
+#define HW6SHARD_H
+#define SHARD_RING 256      // slots per ring; a power of two
+#define SHARD_BATCH 32      // messages a producer holds back before publishing
+
+enum { SHARD_PUT, SHARD_GET };
+#endif
+
+// A request, or its reply: the entry a get found.
+struct HT_(msg) {
+  int op;
+  HT_KEY key;
+  HT_VALUE value;
+  struct HT_(entry) *e;
+};
+
+struct HT_(ring) {
+  volatile long tail __attribute__((aligned(64)));  // published by the producer
+  long next;                                        // producer's next slot
+  volatile long head __attribute__((aligned(64)));  // published by the consumer
+  struct HT_(msg) slot[SHARD_RING] __attribute__((aligned(64)));
+};
+
+struct HT_(deleg) {
+  struct HT_NAME *t;
+  int nshard;
+  struct HT_(ring) *req;    // nshard x nshard; req[c * nshard + s] is c to s
+  struct HT_(ring) *rep;    // rep[s * nshard + c] is s back to c
+  long *out;                // per pair, requests awaiting a reply
+  volatile long finished;   // threads done, summed over all calls
+  long *calls;              // per thread, calls made so far
+};
+
+static void
+HT_(deleg_init)(struct HT_(deleg) *d, struct HT_NAME *t, int nshard)
+{
+  size_t n = (size_t) nshard * nshard;
+
+  d->t = t;
+  d->nshard = nshard;
+  d->req = aligned_alloc(64, sizeof(struct HT_(ring)) * n);
+  d->rep = aligned_alloc(64, sizeof(struct HT_(ring)) * n);
+  d->out = calloc(n, sizeof(long));
+  d->calls = calloc(nshard, sizeof(long));
+  assert(d->req && d->rep && d->out && d->calls);
+  memset(d->req, 0, sizeof(struct HT_(ring)) * n);
+  memset(d->rep, 0, sizeof(struct HT_(ring)) * n);
+  d->finished = 0;
+}
+
+static void
+HT_(deleg_free)(struct HT_(deleg) *d)
+{
+  free(d->req);
+  free(d->rep);
+  free(d->out);
+  free(d->calls);
+}
+
+static inline int
+HT_(owner)(struct HT_(deleg) *d, HT_KEY key)
+{
+  return (uint64_t) HT_(bucket)(d->t, key) * d->nshard / d->t->nbucket;
+}
+
+// The owner's side of a put or get: no lock, nobody else is in there.
+static inline struct HT_(entry) *
+HT_(deleg_apply)(struct HT_NAME *t, int op, HT_KEY key, HT_VALUE value)
+{
+  int b = HT_(bucket)(t, key);
+
+  if (op == SHARD_GET) return HT_(get)(t, key);
+  if (t->bloom) bloom_add(t->bloom, HT_HASH(key));
+  HT_(insert)(t, key, value, &t->table[b], t->table[b]);
+  return 0;
+}
+
+static inline void
+HT_(publish)(struct HT_(ring) *r)
+{
+  if (r->next != r->tail) __atomic_store_n(&r->tail, r->next, __ATOMIC_RELEASE);
+}
+
+// Serve the requests waiting from client c, replying in one batch.
+static void
+HT_(serve)(struct HT_(deleg) *d, int me, int c)
+{
+  struct HT_(ring) *q = &d->req[c * d->nshard + me];
+  struct HT_(ring) *a = &d->rep[me * d->nshard + c];
+  long h = q->head, tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+  struct HT_(msg) *m, *r;
+
+  if (h == tail) return;
+  for (; h < tail; h++) {
+    m = &q->slot[h & (SHARD_RING - 1)];
+    // the client keeps at most SHARD_RING requests out, so a's slot is free
+    r = &a->slot[a->next++ & (SHARD_RING - 1)];
+    r->op = m->op;
+    r->e = HT_(deleg_apply)(d->t, m->op, m->key, m->value);
+  }
+  __atomic_store_n(&q->head, h, __ATOMIC_RELEASE);
+  HT_(publish)(a);
+}
+
+// Take owner s's replies; returns how many of them were gets that missed.
+static long
+HT_(collect)(struct HT_(deleg) *d, int me, int s)
+{
+  struct HT_(ring) *a = &d->rep[s * d->nshard + me];
+  long h = a->head, tail = __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE), missing = 0;
+
+  if (h == tail) return 0;
+  d->out[me * d->nshard + s] -= tail - h;
+  for (; h < tail; h++) {
+    struct HT_(msg) *r = &a->slot[h & (SHARD_RING - 1)];
+    if (r->op == SHARD_GET && r->e == 0) missing++;
+  }
+  __atomic_store_n(&a->head, tail, __ATOMIC_RELEASE);
+  return missing;
+}
+
+// Thread me puts keys[0..n) with vals[0..n), or gets them (vals NULL),
+// through their owners. Every thread must make the same number of calls. Returns the
+// number of gets that missed.
+static long
+HT_(deleg_run)(struct HT_(deleg) *d, int me, int op, HT_KEY *keys, HT_VALUE *vals, long n)
+{
+  long i = 0, j, missing = 0, outstanding, target;
+  struct HT_(ring) *q;
+  int s, ns = d->nshard, done = 0, spin = 0;
+
+  target = ++d->calls[me] * ns;
+  for (;;) {
+    // issue a stretch of our own operations
+    for (j = 0; i < n && j < SHARD_RING; i++, j++) {
+      s = HT_(owner)(d, keys[i]);
+      if (s == me) {
+        if (HT_(deleg_apply)(d->t, op, keys[i], vals ? vals[i] : (HT_VALUE) 0) == 0 &&
+            op == SHARD_GET) missing++;
+        continue;
+      }
+      if (d->out[me * ns + s] == SHARD_RING) break;  // owner s is behind
+      q = &d->req[me * ns + s];
+      q->slot[q->next & (SHARD_RING - 1)].op = op;
+      q->slot[q->next & (SHARD_RING - 1)].key = keys[i];
+      q->slot[q->next & (SHARD_RING - 1)].value = vals ? vals[i] : (HT_VALUE) 0;
+      q->next++;
+      d->out[me * ns + s]++;
+      if (q->next - q->tail >= SHARD_BATCH) HT_(publish)(q);
+    }
+    for (s = 0; s < ns; s++) {
+      if (s == me) continue;
+      HT_(publish)(&d->req[me * ns + s]);
+      HT_(serve)(d, me, s);
+    }
+    for (s = 0, outstanding = 0; s < ns; s++) {
+      if (s == me) continue;
+      missing += HT_(collect)(d, me, s);
+      outstanding += d->out[me * ns + s];
+    }
+    if (j < SHARD_RING && ++spin % 64 == 0) sched_yield();  // waiting on others
+    if (i == n && outstanding == 0) {
+      if (!done) {
+        __sync_fetch_and_add(&d->finished, 1);
+        done = 1;
+      }
+      // others may still need us to serve them
+      if (__atomic_load_n(&d->finished, __ATOMIC_ACQUIRE) >= target) break;
+    }
+  }
+  return missing;
+}
+
+#define HT_DELEGATE
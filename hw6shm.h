@@ -0,0 +1,224 @@
+// Template header for a chained table in a POSIX shared-memory segment,
+// with the same parameters and put/get interface as hw6table.h, which
+// other processes can attach to and read in place.
+//
+// Everything lives in one segment: a header, the bucket locks, the
+// bucket heads and a pool of entries. Links are 32-bit pool indices, as
+// in the compact layout, so they mean the same in every process whatever
+// address it maps the segment at; keys and values are stored as their
+// bytes, so they must not point elsewhere. The locks are process-shared
+// mutexes, and a put publishes its entry with a release store, so a get
+// in any process sees whole entries without a lock.
+//
+// HT_(init) creates the segment under a fresh name; HT_(attach) maps an
+// existing one by name, and HT_(detach) unmaps it. The creator's
+// HT_(unname) removes the name once everyone has attached, and
+// HT_(destroy) unmaps (and unnames) it. Defines HT_SHM to tell
+// hw6bench.h.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HW6SHM_H
+#define HW6SHM_H
+
+#define SHM_MAGIC 0x4d364857      // "WH6M"
+
+struct shm_header {
+  uint32_t magic;
+  uint32_t entrysize;       // to refuse a segment of another type
+  long nbucket;
+  uint32_t npool;
+  volatile uint32_t pooltop;
+  size_t size;              // of the whole segment
+} __attribute__((aligned(64)));
+
+static inline size_t
+shm_round(size_t n)
+{
+  return (n + 63) & ~(size_t) 63;
+}
+
+#endif
+
+struct HT_(entry) {
+  HT_KEY key;
+  HT_VALUE value;
+  uint32_t next;            // pool index; 0 is nil
+};
+
+struct HT_NAME {
+  struct shm_header *h;     // the mapping
+  pthread_mutex_t *locks;
+  volatile uint32_t *table;
+  struct HT_(entry) *pool;
+  long nbucket;
+  int named;                // created here, name not yet removed
+  char name[64];
+};
+
+// Point t's fields into the segment mapped at h.
+static void
+HT_(place)(struct HT_NAME *t, struct shm_header *h)
+{
+  char *p = (char *) h + shm_round(sizeof(*h));
+
+  t->h = h;
+  t->nbucket = h->nbucket;
+  t->locks = (pthread_mutex_t *) p;
+  p += shm_round(sizeof(pthread_mutex_t) * h->nbucket);
+  t->table = (volatile uint32_t *) p;
+  p += shm_round(sizeof(uint32_t) * h->nbucket);
+  t->pool = (struct HT_(entry) *) p;
+}
+
+static void
+HT_(init)(struct HT_NAME *t, long nbucket, long nentry)
+{
+  static int seq;
+  pthread_mutexattr_t a;
+  struct shm_header *h;
+  size_t size;
+  long i;
+  int fd;
+
+  assert(nentry + 1 <= UINT32_MAX);
+  size = shm_round(sizeof(*h)) + shm_round(sizeof(pthread_mutex_t) * nbucket) +
+    shm_round(sizeof(uint32_t) * nbucket) + sizeof(struct HT_(entry)) * (nentry + 1);
+  snprintf(t->name, sizeof(t->name), "/hw6-%d-%d", (int) getpid(), __sync_fetch_and_add(&seq, 1));
+  fd = shm_open(t->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  assert(fd >= 0);
+  assert(ftruncate(fd, size) == 0);  // zero-filled: every head and link is nil
+  h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(h != MAP_FAILED);
+  close(fd);
+  h->magic = SHM_MAGIC;
+  h->entrysize = sizeof(struct HT_(entry));
+  h->nbucket = nbucket;
+  h->npool = nentry + 1;
+  h->pooltop = 1;
+  h->size = size;
+  HT_(place)(t, h);
+  pthread_mutexattr_init(&a);
+  pthread_mutexattr_setpshared(&a, PTHREAD_PROCESS_SHARED);
+  for (i = 0; i < nbucket; i++) {
+    pthread_mutex_init(t->locks + i, &a);
+  }
+  pthread_mutexattr_destroy(&a);
+  t->named = 1;
+}
+
+// Remove the segment's name; mappings stay valid.
+static void
+HT_(unname)(struct HT_NAME *t)
+{
+  if (t->named) shm_unlink(t->name);
+  t->named = 0;
+}
+
+static void
+HT_(destroy)(struct HT_NAME *t)
+{
+  long i;
+
+  for (i = 0; i < t->nbucket; i++) {
+    pthread_mutex_destroy(t->locks + i);
+  }
+  HT_(unname)(t);
+  munmap(t->h, t->h->size);
+  t->h = NULL;
+}
+
+// Map the segment named name into t; 0 if it isn't one of this type.
+static int
+HT_(attach)(struct HT_NAME *t, const char *name)
+{
+  struct shm_header *h;
+  struct stat st;
+  int fd = shm_open(name, O_RDWR, 0);
+
+  if (fd < 0) return 0;
+  assert(fstat(fd, &st) == 0);
+  h = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  assert(h != MAP_FAILED);
+  if ((size_t) st.st_size < sizeof(*h) || h->magic != SHM_MAGIC ||
+      h->entrysize != sizeof(struct HT_(entry)) || h->size != (size_t) st.st_size) {
+    munmap(h, st.st_size);
+    return 0;
+  }
+  HT_(place)(t, h);
+  t->named = 0;
+  snprintf(t->name, sizeof(t->name), "%s", name);
+  return 1;
+}
+
+static void
+HT_(detach)(struct HT_NAME *t)
+{
+  munmap(t->h, t->h->size);
+  t->h = NULL;
+}
+
+static inline long
+HT_(bucket)(struct HT_NAME *t, HT_KEY key)
+{
+  return HT_HASH(key) % t->nbucket;
+}
+
+static void
+HT_(put)(struct HT_NAME *t, HT_KEY key, HT_VALUE value)
+{
+  long b = HT_(bucket)(t, key);
+  uint32_t l = __sync_fetch_and_add(&t->h->pooltop, 1);
+  struct HT_(entry) *e = &t->pool[l];
+
+  assert(l < t->h->npool);
+  e->key = key;
+  e->value = value;
+  pthread_mutex_lock(t->locks + b);
+  e->next = t->table[b];
+  __atomic_store_n(&t->table[b], l, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(t->locks + b);
+}
+
+static struct HT_(entry) *
+HT_(get)(struct HT_NAME *t, HT_KEY key)
+{
+  uint32_t l = __atomic_load_n(&t->table[HT_(bucket)(t, key)], __ATOMIC_ACQUIRE);
+
+  for (; l != 0; l = t->pool[l].next) {
+    if (HT_EQ(t->pool[l].key, key)) return &t->pool[l];
+  }
+  return 0;
+}
+
+static size_t
+HT_(bytes)(struct HT_NAME *t)
+{
+  return t->h->size;
+}
+
+static void
+HT_(report)(struct HT_NAME *t, long n)
+{
+  printf("shm: segment %s, %zu-byte entries, %.1f bytes/key\n", t->name,
+         sizeof(struct HT_(entry)), (double) HT_(bytes)(t) / n);
+}
+
+#define HT_SHM
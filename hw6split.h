@@ -0,0 +1,244 @@
+// Template header for a lock-free, resizable split-ordered table (Shalev
+// and Shavit, "Split-ordered lists"), with the same parameters and
+// put/get interface as hw6table.h.
+//
+// All entries sit in one lock-free linked list sorted by bit-reversed
+// hash. A bucket is just a shortcut into that list: a dummy node whose
+// reversed key sorts right before the bucket's entries. Doubling the
+// table only raises nbucket; each new bucket is initialized lazily, on
+// first use, by splicing its dummy in after its parent bucket's. Nothing
+// ever moves, so put() and get() carry on while the table grows, and no
+// operation takes a lock. The bucket array is a directory of segments,
+// allocated as they are first needed, so it also grows without copying.
+//
+// put() inserts, or overwrites the value of a key already present. There
+// is no delete, so list pointers need no mark bits.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HT_INTERN
+#define HT_INTERN(k) (k)
+#endif
+
+#ifndef HW6SPLIT_H
+#define HW6SPLIT_H
+
+#define SPLIT_MAXLOAD 2       // entries per bucket before doubling
+#define SPLIT_NSEG 48         // segment s > 0 holds buckets [2^(s-1), 2^s)
+#define SPLIT_COUNTBATCH 32   // inserts a thread counts before publishing
+
+static inline uint64_t
+split_reverse(uint64_t x)
+{
+  x = (x >> 1 & 0x5555555555555555ULL) | (x & 0x5555555555555555ULL) << 1;
+  x = (x >> 2 & 0x3333333333333333ULL) | (x & 0x3333333333333333ULL) << 2;
+  x = (x >> 4 & 0x0f0f0f0f0f0f0f0fULL) | (x & 0x0f0f0f0f0f0f0f0fULL) << 4;
+  return __builtin_bswap64(x);
+}
+
+// Spread the key hash so that its low bits, which pick the bucket, are
+// good even for identity hashes.
+static inline uint64_t
+split_mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline int
+split_segment(uint64_t b)
+{
+  return b == 0 ? 0 : 64 - __builtin_clzll(b);
+}
+
+#endif
+
+struct HT_(entry) {
+  uint64_t so;              // reversed hash; low bit set for real entries
+  struct HT_(entry) *next;
+  HT_KEY key;               // unused in dummies
+  HT_VALUE value;
+};
+
+struct HT_NAME {
+  struct HT_(entry) **seg[SPLIT_NSEG];
+  volatile uint64_t nbucket;    // always a power of two
+  volatile long count;
+  volatile long ninit;          // buckets initialized so far
+};
+
+static __thread long HT_(uncounted);
+
+static struct HT_(entry) **
+HT_(slot)(struct HT_NAME *t, uint64_t b)
+{
+  int s = split_segment(b);
+  uint64_t size = s == 0 ? 1 : 1ULL << (s - 1);
+  struct HT_(entry) **seg = __atomic_load_n(&t->seg[s], __ATOMIC_ACQUIRE);
+
+  assert(s < SPLIT_NSEG);
+  if (seg == NULL) {
+    struct HT_(entry) **fresh = calloc(size, sizeof(struct HT_(entry) *));
+    assert(fresh);
+    if (__sync_bool_compare_and_swap(&t->seg[s], NULL, fresh)) {
+      seg = fresh;
+    } else {
+      free(fresh);
+      seg = t->seg[s];
+    }
+  }
+  return &seg[s == 0 ? 0 : b - size];
+}
+
+// Insert n into the list after start, in split order. If n is a dummy
+// already present, or an entry with n's key is, leave n out and return
+// that node instead.
+static struct HT_(entry) *
+HT_(splice)(struct HT_(entry) *start, struct HT_(entry) *n)
+{
+  struct HT_(entry) *prev, *cur;
+
+  for (;;) {
+    prev = start;
+    cur = __atomic_load_n(&prev->next, __ATOMIC_ACQUIRE);
+    while (cur && cur->so < n->so) {
+      prev = cur;
+      cur = __atomic_load_n(&cur->next, __ATOMIC_ACQUIRE);
+    }
+    while (cur && cur->so == n->so) {
+      if (!(n->so & 1) || HT_EQ(cur->key, n->key)) return cur;
+      prev = cur;
+      cur = __atomic_load_n(&cur->next, __ATOMIC_ACQUIRE);
+    }
+    n->next = cur;
+    if (__sync_bool_compare_and_swap(&prev->next, cur, n)) return n;
+  }
+}
+
+// The dummy of bucket b, splicing it in (and its parents') if needed.
+static struct HT_(entry) *
+HT_(head)(struct HT_NAME *t, uint64_t b)
+{
+  struct HT_(entry) **slot = HT_(slot)(t, b);
+  struct HT_(entry) *d = __atomic_load_n(slot, __ATOMIC_ACQUIRE), *parent, *got;
+
+  if (d) return d;
+  // the parent is b without its top bit; its dummy sorts just before b's
+  parent = HT_(head)(t, b & ~(1ULL << (63 - __builtin_clzll(b))));
+  d = malloc(sizeof(struct HT_(entry)));
+  assert(d);
+  d->so = split_reverse(b);
+  got = HT_(splice)(parent, d);
+  if (got != d) free(d);
+  if (__sync_bool_compare_and_swap(slot, NULL, got)) __sync_fetch_and_add(&t->ninit, 1);
+  return got;
+}
+
+static void
+HT_(init)(struct HT_NAME *t, long nbucket, long nentry)
+{
+  struct HT_(entry) *d = malloc(sizeof(struct HT_(entry)));
+  uint64_t n = 1;
+
+  (void) nentry;
+  memset(t, 0, sizeof(*t));
+  while (n < (uint64_t) nbucket) n <<= 1;
+  t->nbucket = n;
+  assert(d);
+  d->so = 0;
+  d->next = NULL;
+  *HT_(slot)(t, 0) = d;
+  t->ninit = 1;
+}
+
+static void
+HT_(destroy)(struct HT_NAME *t)
+{
+  struct HT_(entry) *e, *next;
+  int s;
+
+  for (e = *HT_(slot)(t, 0); e != NULL; e = next) {
+    next = e->next;
+    free(e);
+  }
+  for (s = 0; s < SPLIT_NSEG; s++) {
+    free(t->seg[s]);
+  }
+}
+
+static void
+HT_(put)(struct HT_NAME *t, HT_KEY key, HT_VALUE value)
+{
+  uint64_t h = split_mix(HT_HASH(key));
+  uint64_t size = t->nbucket;
+  struct HT_(entry) *n = malloc(sizeof(struct HT_(entry))), *got;
+  long c;
+
+  assert(n);
+  n->so = split_reverse(h) | 1;
+  n->key = HT_INTERN(key);
+  n->value = value;
+  got = HT_(splice)(HT_(head)(t, h & (size - 1)), n);
+  if (got != n) {
+    got->value = value;
+    free(n);
+    return;
+  }
+  if (++HT_(uncounted) < SPLIT_COUNTBATCH) return;
+  c = __sync_add_and_fetch(&t->count, HT_(uncounted));
+  HT_(uncounted) = 0;
+  if (c > (long) size * SPLIT_MAXLOAD && split_segment(size) + 1 < SPLIT_NSEG) {
+    __sync_bool_compare_and_swap(&t->nbucket, size, size * 2);
+  }
+}
+
+static struct HT_(entry) *
+HT_(get)(struct HT_NAME *t, HT_KEY key)
+{
+  uint64_t h = split_mix(HT_HASH(key));
+  uint64_t so = split_reverse(h) | 1;
+  struct HT_(entry) *e = HT_(head)(t, h & (t->nbucket - 1));
+
+  for (e = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE); e && e->so <= so;
+       e = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE)) {
+    if (e->so == so && HT_EQ(e->key, key)) return e;
+  }
+  return 0;
+}
+
+static size_t
+HT_(bytes)(struct HT_NAME *t)
+{
+  size_t n = 0;
+  struct HT_(entry) *e;
+  int s;
+
+  for (s = 0; s < SPLIT_NSEG; s++) {
+    if (t->seg[s]) n += sizeof(struct HT_(entry) *) * (s == 0 ? 1 : 1ULL << (s - 1));
+  }
+  for (e = *HT_(slot)(t, 0); e != NULL; e = e->next) {
+    n += malloc_usable_size(e) + sizeof(size_t);
+  }
+  return n;
+}
+
+static void
+HT_(report)(struct HT_NAME *t, long n)
+{
+  printf("split: %lu buckets, %ld initialized, %.1f bytes/key\n",
+         (unsigned long) t->nbucket, t->ninit, (double) HT_(bytes)(t) / n);
+}
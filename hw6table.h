@@ -0,0 +1,823 @@
+// Template header for the hw6 chained hash table.
+// Other backends (hw6robin.h, ...) follow the same interface:
+// init/destroy/put/get/bytes/report.
+//
+// Define these before including, once per instantiation:
+//   HT_NAME      prefix of the generated types and functions
+//   HT_KEY       key type
+//   HT_VALUE     value type
+//   HT_HASH(k)   hash of a key, as a uint64_t
+//   HT_EQ(a, b)  nonzero if two keys are equal
+// and optionally:
+//   HT_COMPACT   allocate entries from a per-table pool and link them with
+//                32-bit pool indices instead of pointers (index 0 is nil)
+//   HT_INTERN(k) the copy of a new key that an entry stores, for keys
+//                that point at bytes the caller may not keep
+//
+// A table may carry a Bloom filter (hw6bloom.h) over its keys: set
+// t->bloom after init, before the first put, and get() answers misses
+// from the filter without walking a chain. HT_(combining)(t) switches
+// put() to flat combining. HT_(accumulate) adds to a key's value in place.
+// HT_(stats) measures the table in parallel.
+// Batch operations hash their keys with the batch kernel of hw6hash.h.
+// HT_(for_each) visits a consistent snapshot of the table in parallel
+// while puts go on.
+//
+// Everything is generated as static functions on concrete types, so the
+// compiler sees the hash and the comparison inline; there is no void *
+// or function pointer on the put/get path. The parameters stay defined
+// after the include (hw6bench.h consumes them), and HT_CHAINED is
+// defined to tell hw6bench.h the chained-only operations are there.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include "hw6bloom.h"
+#include "hw6hash.h"
+
+#ifndef HW6TABLE_H
+#define HW6TABLE_H
+
+#define HT_HISTMAX 16   // chains this long or longer share the last bin
+#define HT_EACHSET 16   // HT_(for_each) dedups longer chains with a set
+
+struct ht_stats {
+  size_t bytes;         // allocated, counting malloc's chunk headers
+  long nentry;
+  long nbucket;
+  long empty;           // buckets with no entries
+  long longest;         // longest chain
+  long hist[HT_HISTMAX + 1];  // buckets by chain length
+};
+
+// Bytes malloc really spent on p.
+static inline size_t
+ht_chunk(void *p)
+{
+  return p ? malloc_usable_size(p) + sizeof(size_t) : 0;
+}
+
+static void
+ht_stats_print(struct ht_stats *s)
+{
+  int i;
+
+  printf("stats: %zu bytes, %.1f bytes/key, load factor %.2f\n", s->bytes,
+         s->nentry ? (double) s->bytes / s->nentry : 0.0,
+         (double) s->nentry / s->nbucket);
+  printf("stats: %ld entries, %ld buckets, %.1f%% empty, longest chain %ld\n",
+         s->nentry, s->nbucket, 100.0 * s->empty / s->nbucket, s->longest);
+  printf("stats: chain length histogram\n");
+  for (i = 0; i <= HT_HISTMAX; i++) {
+    if (s->hist[i] == 0) continue;
+    printf("  %3d%s %10ld buckets %5.1f%%\n", i, i == HT_HISTMAX ? "+" : " ",
+           s->hist[i], 100.0 * s->hist[i] / s->nbucket);
+  }
+}
+
+#endif
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HT_INTERN
+#define HT_INTERN(k) (k)
+#endif
+
+#ifndef HT_POOLCHUNK
+#define HT_POOLCHUNK 256  // pool entries a thread claims at a time
+#endif
+
+struct HT_(entry);
+#ifdef HT_COMPACT
+typedef uint32_t HT_(link);
+#else
+typedef struct HT_(entry) *HT_(link);
+#endif
+
+struct HT_(entry) {
+  HT_KEY key;
+  HT_VALUE value;
+  HT_(link) next;
+};
+
+// A put waiting to be applied by whichever thread holds the bucket lock.
+struct HT_(fcreq) {
+  HT_KEY key;
+  HT_VALUE value;
+  struct HT_(fcreq) *next;
+  volatile int done;
+};
+
+struct HT_NAME {
+  int nbucket;
+  pthread_mutex_t *locks;
+  HT_(link) *table;
+  struct bloom *bloom;      // optional filter over the keys, or NULL
+  struct HT_(fcreq) *volatile *pub;  // per-bucket publication lists, or NULL
+  HT_(link) *snaphead;      // per bucket, its head as of snapepoch, or NULL
+  uint32_t *snapepoch;
+  volatile uint32_t epoch;  // current snapshot
+  pthread_mutex_t snaplock; // one snapshot at a time
+#ifdef HT_COMPACT
+  struct HT_(entry) *pool;
+  uint32_t npool;           // capacity of pool
+  uint32_t pooltop;         // next unclaimed pool index
+#endif
+};
+
+// nentry is the most entries the table will hold; only the compact
+// layout needs it, to size its pool. Each inserting thread may strand up
+// to HT_POOLCHUNK of them at the end of its last chunk.
+static void
+HT_(init)(struct HT_NAME *t, int nbucket, long nentry)
+{
+  int i;
+
+  t->nbucket = nbucket;
+  t->locks = malloc(sizeof(pthread_mutex_t) * nbucket);
+  t->table = calloc(nbucket, sizeof(HT_(link)));
+  assert(t->locks && t->table);
+  t->bloom = NULL;
+  t->pub = NULL;
+  t->snaphead = NULL;
+  t->snapepoch = NULL;
+  t->epoch = 0;
+  pthread_mutex_init(&t->snaplock, NULL);
+  for (i = 0; i < nbucket; i++) {
+    pthread_mutex_init(t->locks + i, NULL);
+  }
+#ifdef HT_COMPACT
+  nentry++;
+  assert(nentry <= UINT32_MAX);
+  t->npool = nentry;
+  t->pool = malloc(sizeof(struct HT_(entry)) * nentry);
+  assert(t->pool);
+  t->pooltop = 1;
+#else
+  (void) nentry;
+#endif
+}
+
+// Free everything init and the puts allocated; t may be init'd again.
+static void
+HT_(destroy)(struct HT_NAME *t)
+{
+  int i;
+#ifndef HT_COMPACT
+  struct HT_(entry) *e, *next;
+
+  for (i = 0; i < t->nbucket; i++) {
+    for (e = t->table[i]; e != 0; e = next) {
+      next = e->next;
+      free(e);
+    }
+  }
+#else
+  free(t->pool);
+#endif
+  for (i = 0; i < t->nbucket; i++) {
+    pthread_mutex_destroy(t->locks + i);
+  }
+  if (t->bloom) bloom_free(t->bloom);
+  free((void *) t->pub);
+  free(t->snaphead);
+  free(t->snapepoch);
+  pthread_mutex_destroy(&t->snaplock);
+  free(t->locks);
+  free(t->table);
+  t->table = NULL;
+}
+
+static inline struct HT_(entry) *
+HT_(deref)(struct HT_NAME *t, HT_(link) l)
+{
+#ifdef HT_COMPACT
+  return l ? &t->pool[l] : 0;
+#else
+  (void) t;
+  return l;
+#endif
+}
+
+#ifdef HT_COMPACT
+// Per-thread chunk of the pool, so that threads only touch the shared
+// pooltop once every HT_POOLCHUNK inserts.
+static __thread struct HT_NAME *HT_(chunkowner);
+static __thread uint32_t HT_(chunknext), HT_(chunkend);
+
+static uint32_t
+HT_(alloc)(struct HT_NAME *t)
+{
+  if (HT_(chunkowner) != t || HT_(chunknext) == HT_(chunkend)) {
+    HT_(chunknext) = __sync_fetch_and_add(&t->pooltop, HT_POOLCHUNK);
+    HT_(chunkend) = HT_(chunknext) + HT_POOLCHUNK;
+    HT_(chunkowner) = t;
+    assert(HT_(chunkend) <= t->npool);
+  }
+  return HT_(chunknext)++;
+}
+#endif
+
+static inline int
+HT_(bucket)(struct HT_NAME *t, HT_KEY key)
+{
+  return HT_HASH(key) % t->nbucket;
+}
+
+// The buckets of keys[0..n) into out, with the batch kernel.
+static void
+HT_(buckets)(struct HT_NAME *t, HT_KEY *keys, long n, uint32_t *out)
+{
+  uint64_t h[HASH_CHUNK];
+  long i;
+  int j, m;
+
+  for (i = 0; i < n; i += m) {
+    m = n - i < HASH_CHUNK ? n - i : HASH_CHUNK;
+    for (j = 0; j < m; j++) {
+      h[j] = HT_HASH(keys[i + j]);
+    }
+    hash_reduce(h, m, t->nbucket, out + i);
+  }
+}
+
+// The first change to bucket b since the current snapshot began saves
+// the head the snapshot should see; the caller holds b's lock.
+static inline void
+HT_(preserve)(struct HT_NAME *t, long b)
+{
+  uint32_t e = __atomic_load_n(&t->epoch, __ATOMIC_ACQUIRE);
+
+  if (t->snapepoch[b] != e) {
+    t->snaphead[b] = t->table[b];
+    t->snapepoch[b] = e;
+  }
+}
+
+static void
+HT_(insert)(struct HT_NAME *t, HT_KEY key, HT_VALUE value, HT_(link) *p, HT_(link) n)
+{
+#ifdef HT_COMPACT
+  uint32_t l = HT_(alloc)(t);
+  struct HT_(entry) *e = &t->pool[l];
+#else
+  struct HT_(entry) *e = malloc(sizeof(struct HT_(entry)));
+  HT_(link) l = e;
+#endif
+  e->key = HT_INTERN(key);
+  e->value = value;
+  e->next = n;
+  if (__atomic_load_n(&t->snaphead, __ATOMIC_ACQUIRE)) HT_(preserve)(t, p - t->table);
+  // release, for HT_(accumulate)'s lock-free walk
+  __atomic_store_n(p, l, __ATOMIC_RELEASE);
+}
+
+// Flat combining: a put publishes its request on the bucket's list, and
+// whoever holds the bucket lock applies every published request in one
+// pass. Under skew the hot bucket's lock changes hands once per batch
+// instead of once per put.
+static void
+HT_(combining)(struct HT_NAME *t)
+{
+  t->pub = calloc(t->nbucket, sizeof(struct HT_(fcreq) *));
+  assert(t->pub);
+}
+
+// Apply everything published on bucket i; the caller holds its lock.
+static void
+HT_(combine)(struct HT_NAME *t, int i)
+{
+  struct HT_(fcreq) *r, *next, *batch;
+
+  while ((batch = __sync_lock_test_and_set(&t->pub[i], NULL)) != NULL) {
+    // the list is newest first; reverse it to apply puts in arrival order
+    for (r = NULL; batch != NULL; batch = next) {
+      next = batch->next;
+      batch->next = r;
+      r = batch;
+    }
+    for (; r != NULL; r = next) {
+      next = r->next;       // r belongs to its owner again once done is set
+      HT_(insert)(t, r->key, r->value, &t->table[i], t->table[i]);
+      __atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+static void
+HT_(put_combining)(struct HT_NAME *t, int i, HT_KEY key, HT_VALUE value)
+{
+  struct HT_(fcreq) req = { key, value, NULL, 0 };
+  int spin = 0;
+
+  do {
+    req.next = t->pub[i];
+  } while (!__sync_bool_compare_and_swap(&t->pub[i], req.next, &req));
+  while (!__atomic_load_n(&req.done, __ATOMIC_ACQUIRE)) {
+    if (pthread_mutex_trylock(t->locks + i) == 0) {
+      HT_(combine)(t, i);
+      pthread_mutex_unlock(t->locks + i);
+    } else if (++spin % 64 == 0) {
+      sched_yield();
+    }
+  }
+}
+
+static void
+HT_(put)(struct HT_NAME *t, HT_KEY key, HT_VALUE value)
+{
+  int i = HT_(bucket)(t, key);
+  // set the filter bits first, so anyone who can see the entry passes it
+  if (t->bloom) bloom_add(t->bloom, HT_HASH(key));
+  if (t->pub) {
+    HT_(put_combining)(t, i, key, value);
+    return;
+  }
+  pthread_mutex_lock(t->locks + i);
+  HT_(insert)(t, key, value, &t->table[i], t->table[i]);
+  pthread_mutex_unlock(t->locks + i);
+}
+
+// Add delta to key's value, or put key with value delta if it has none,
+// atomically with respect to other accumulates. HT_VALUE must be an
+// integer or pointer type; pointers are added to as integers. Adding to
+// an entry already there takes no lock.
+static void
+HT_(accumulate)(struct HT_NAME *t, HT_KEY key, HT_VALUE delta)
+{
+  int i = HT_(bucket)(t, key);
+  HT_(link) seen = __atomic_load_n(&t->table[i], __ATOMIC_ACQUIRE), l;
+  struct HT_(entry) *e;
+
+  for (e = HT_(deref)(t, seen); e != 0; e = HT_(deref)(t, e->next)) {
+    if (HT_EQ(e->key, key)) {
+      __atomic_fetch_add(&e->value, (uintptr_t) delta, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  if (t->bloom) bloom_add(t->bloom, HT_HASH(key));
+  pthread_mutex_lock(t->locks + i);
+  // only entries inserted since the walk above can hold key
+  for (l = t->table[i]; l != seen; l = e->next) {
+    e = HT_(deref)(t, l);
+    if (HT_EQ(e->key, key)) break;
+  }
+  if (l != seen) __atomic_fetch_add(&e->value, (uintptr_t) delta, __ATOMIC_RELAXED);
+  else HT_(insert)(t, key, delta, &t->table[i], t->table[i]);
+  pthread_mutex_unlock(t->locks + i);
+}
+
+static struct HT_(entry) *
+HT_(get)(struct HT_NAME *t, HT_KEY key)
+{
+  /* no lock is required as every thread is done */
+  struct HT_(entry) *e = 0;
+  if (t->bloom && !bloom_test(t->bloom, HT_HASH(key))) return 0;
+  for (e = HT_(deref)(t, t->table[HT_(bucket)(t, key)]); e != 0; e = HT_(deref)(t, e->next)) {
+    if (HT_EQ(e->key, key)) break;
+  }
+  return e;
+}
+
+// Interleaved lookup of n keys: up to k chain walks run as small state
+// machines, each prefetching its next node and yielding to the others,
+// so the cache misses of k walks overlap. res[i] gets get(keys[i]).
+
+#ifndef HT_MAXINTERLEAVE
+#define HT_MAXINTERLEAVE 64
+#endif
+
+struct HT_(walk) {
+  long i;                       // index of the key being looked up
+  int state;                    // 0: at bucket head, 1: at entry
+  HT_(link) *head;
+  struct HT_(entry) *e;
+};
+
+// Keys are started in order; bk holds the buckets of the current
+// HASH_CHUNK of them, hashed when the first one starts.
+static inline void
+HT_(walkstart)(struct HT_NAME *t, struct HT_(walk) *s, HT_KEY *keys, long n, long i,
+               uint32_t *bk)
+{
+  if (i % HASH_CHUNK == 0) {
+    HT_(buckets)(t, keys + i, n - i < HASH_CHUNK ? n - i : HASH_CHUNK, bk);
+  }
+  s->i = i;
+  s->state = 0;
+  s->head = &t->table[bk[i % HASH_CHUNK]];
+  if (t->bloom) __builtin_prefetch(bloom_block(t->bloom, HT_HASH(keys[i])));
+  __builtin_prefetch(s->head);
+}
+
+static void
+HT_(get_batch)(struct HT_NAME *t, HT_KEY *keys, long n, int k, struct HT_(entry) **res)
+{
+  struct HT_(walk) w[HT_MAXINTERLEAVE];
+  uint32_t bk[HASH_CHUNK];
+  long next = 0;
+  int j, live = 0;
+
+  if (k > HT_MAXINTERLEAVE) k = HT_MAXINTERLEAVE;
+  if (k < 1) k = 1;
+  for (j = 0; j < k; j++) {
+    w[j].i = -1;
+    if (next < n) {
+      HT_(walkstart)(t, &w[j], keys, n, next++, bk);
+      live++;
+    }
+  }
+  while (live > 0) {
+    for (j = 0; j < k; j++) {
+      struct HT_(walk) *s = &w[j];
+      if (s->i < 0) continue;
+      if (s->state == 0) {
+        if (t->bloom && !bloom_test(t->bloom, HT_HASH(keys[s->i]))) {
+          res[s->i] = 0;
+          goto done;
+        }
+        s->e = HT_(deref)(t, *s->head);
+        s->state = 1;
+      } else if (HT_EQ(s->e->key, keys[s->i])) {
+        res[s->i] = s->e;
+        goto done;
+      } else {
+        s->e = HT_(deref)(t, s->e->next);
+      }
+      if (s->e) {
+        __builtin_prefetch(s->e);
+        continue;
+      }
+      res[s->i] = 0;
+    done:
+      // start the next key in this slot
+      if (next < n) {
+        HT_(walkstart)(t, s, keys, n, next++, bk);
+      } else {
+        s->i = -1;
+        live--;
+      }
+    }
+  }
+}
+
+// Parallel bulk load: radix-partition the input by bucket range, then
+// let each thread build whole partitions with no locking. Duplicate keys
+// end up in the same order as n sequential put()s would leave them.
+
+struct HT_(bulk) {
+  struct HT_NAME *t;
+  HT_KEY *keys;
+  HT_VALUE *vals;
+  long n;
+  int nthreads;
+  int npart;
+  int phase;
+  long *hist;             // nthreads x npart counts, then scatter offsets
+  long *pstart;           // npart+1 partition boundaries
+  uint32_t *bk;           // bucket of each key, hashed once
+  HT_KEY *pkeys;
+  HT_VALUE *pvals;
+  uint32_t *pbk;
+  volatile int nextpart;
+};
+
+struct HT_(bulkworker) {
+  struct HT_(bulk) *b;
+  long id;
+};
+
+static inline int
+HT_(bulkpart)(struct HT_(bulk) *b, int bucket)
+{
+  return (uint64_t) bucket * b->npart / b->t->nbucket;
+}
+
+static void *
+HT_(bulkthread)(void *xa)
+{
+  struct HT_(bulkworker) *w = xa;
+  struct HT_(bulk) *b = w->b;
+  struct HT_NAME *t = b->t;
+  long lo = b->n * w->id / b->nthreads;
+  long hi = b->n * (w->id + 1) / b->nthreads;
+  long *h = b->hist + w->id * b->npart;
+  long i, j;
+  int p, k;
+
+  switch (b->phase) {
+  case 0:  // hash and histogram this thread's slice
+    HT_(buckets)(t, b->keys + lo, hi - lo, b->bk + lo);
+    for (i = lo; i < hi; i++) {
+      if (t->bloom) bloom_add(t->bloom, HT_HASH(b->keys[i]));
+      h[HT_(bulkpart)(b, b->bk[i])]++;
+    }
+    break;
+  case 1:  // scatter this thread's slice into its partition slots
+    for (i = lo; i < hi; i++) {
+      j = h[HT_(bulkpart)(b, b->bk[i])]++;
+      b->pkeys[j] = b->keys[i];
+      b->pvals[j] = b->vals[i];
+      b->pbk[j] = b->bk[i];
+    }
+    break;
+  case 2:  // build whole partitions; no other thread touches their buckets
+    while ((p = __sync_fetch_and_add(&b->nextpart, 1)) < b->npart) {
+      for (i = b->pstart[p]; i < b->pstart[p+1]; i++) {
+        k = b->pbk[i];
+        HT_(insert)(t, b->pkeys[i], b->pvals[i], &t->table[k], t->table[k]);
+      }
+    }
+    break;
+  }
+  return NULL;
+}
+
+static void
+HT_(bulkphase)(struct HT_(bulk) *b, int phase)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * b->nthreads);
+  struct HT_(bulkworker) *w = malloc(sizeof(*w) * b->nthreads);
+  void *value;
+  long i;
+
+  b->phase = phase;
+  for (i = 0; i < b->nthreads; i++) {
+    w[i].b = b;
+    w[i].id = i;
+    assert(pthread_create(&tha[i], NULL, HT_(bulkthread), &w[i]) == 0);
+  }
+  for (i = 0; i < b->nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+  free(w);
+  free(tha);
+}
+
+// Load n keys into an empty table using nthreads threads. Afterwards t is
+// an ordinary table.
+static void
+HT_(bulk_load)(struct HT_NAME *t, HT_KEY *keys, HT_VALUE *vals, long n, int nthreads)
+{
+  struct HT_(bulk) b;
+  long off = 0, c;
+  int p, i;
+
+  b.t = t;
+  b.keys = keys;
+  b.vals = vals;
+  b.n = n;
+  b.nthreads = nthreads;
+  b.npart = nthreads * 16 < t->nbucket ? nthreads * 16 : t->nbucket;
+  b.hist = calloc((long) nthreads * b.npart, sizeof(long));
+  b.pstart = malloc(sizeof(long) * (b.npart + 1));
+  b.pkeys = malloc(sizeof(HT_KEY) * n);
+  b.pvals = malloc(sizeof(HT_VALUE) * n);
+  b.bk = malloc(sizeof(uint32_t) * n);
+  b.pbk = malloc(sizeof(uint32_t) * n);
+  b.nextpart = 0;
+  assert(b.hist && b.pstart && b.pkeys && b.pvals && b.bk && b.pbk);
+
+  HT_(bulkphase)(&b, 0);
+  // turn counts into offsets: partition-major, then thread order, which
+  // keeps each partition in input order
+  for (p = 0; p < b.npart; p++) {
+    b.pstart[p] = off;
+    for (i = 0; i < nthreads; i++) {
+      c = b.hist[(long) i * b.npart + p];
+      b.hist[(long) i * b.npart + p] = off;
+      off += c;
+    }
+  }
+  b.pstart[b.npart] = off;
+  HT_(bulkphase)(&b, 1);
+  HT_(bulkphase)(&b, 2);
+
+  free(b.hist);
+  free(b.pstart);
+  free(b.pkeys);
+  free(b.pvals);
+  free(b.bk);
+  free(b.pbk);
+}
+
+// Bytes held by the table, counting malloc's per-chunk header for the
+// pointer layout.
+static size_t
+HT_(bytes)(struct HT_NAME *t)
+{
+  size_t n = (sizeof(HT_(link)) + sizeof(pthread_mutex_t)) * t->nbucket;
+  if (t->bloom) n += (t->bloom->mask + 1) * BLOOM_BLOCKWORDS * sizeof(uint64_t);
+  if (t->snaphead) n += (sizeof(HT_(link)) + sizeof(uint32_t)) * t->nbucket;
+#ifdef HT_COMPACT
+  n += sizeof(struct HT_(entry)) * t->npool;
+#else
+  struct HT_(entry) *e;
+  int i;
+
+  for (i = 0; i < t->nbucket; i++) {
+    for (e = t->table[i]; e != 0; e = e->next) {
+      n += malloc_usable_size(e) + sizeof(size_t);
+    }
+  }
+#endif
+  return n;
+}
+
+// Snapshot iteration: fn(key, value, thread, arg) for every key in the
+// table as it was when HT_(for_each) was called, with its newest value,
+// on nthreads threads that each take a range of buckets. Puts may run
+// meanwhile, but not a bulk load.
+//
+// Chains only ever grow at the head, so a bucket's head at the snapshot
+// pins its whole chain. Starting a snapshot bumps t->epoch; the first
+// insert into a bucket under the new epoch saves the old head for the
+// snapshot (HT_(preserve)) before linking. A put that read the epoch
+// before the bump is in the snapshot, one that read it after is not.
+
+struct HT_(eachworker) {
+  struct HT_NAME *t;
+  long lo, hi;
+  int id;
+  uint32_t epoch;
+  void (*fn)(HT_KEY, HT_VALUE, int, void *);
+  void *arg;
+};
+
+// Visit a range of buckets, skipping keys that a newer entry nearer the
+// head shadows. Short chains check each entry against those before it;
+// longer ones keep the keys seen so far in an open-addressing set, so a
+// chain costs time linear in its length.
+static void *
+HT_(eachthread)(void *xa)
+{
+  struct HT_(eachworker) *w = xa;
+  struct HT_NAME *t = w->t;
+  struct HT_(entry) *e, *o, **seen = NULL;
+  HT_(link) head;
+  long b, len, nseen = 0;
+  uint64_t mask, s;
+
+  for (b = w->lo; b < w->hi; b++) {
+    // the lock waits out an insert between reading the epoch and linking
+    pthread_mutex_lock(t->locks + b);
+    head = t->snapepoch[b] == w->epoch ? t->snaphead[b] : t->table[b];
+    pthread_mutex_unlock(t->locks + b);
+    len = 0;
+    for (e = HT_(deref)(t, head); e != 0; e = HT_(deref)(t, e->next)) {
+      len++;
+    }
+    if (len <= HT_EACHSET) {
+      for (e = HT_(deref)(t, head); e != 0; e = HT_(deref)(t, e->next)) {
+        for (o = HT_(deref)(t, head); o != e; o = HT_(deref)(t, o->next)) {
+          if (HT_EQ(o->key, e->key)) break;
+        }
+        if (o == e) w->fn(e->key, e->value, w->id, w->arg);
+      }
+      continue;
+    }
+    for (mask = 63; mask + 1 < 2 * (uint64_t) len; mask = 2 * mask + 1) ;
+    if ((long) mask + 1 > nseen) {
+      free(seen);
+      nseen = mask + 1;
+      seen = malloc(sizeof(*seen) * nseen);
+      assert(seen);
+    }
+    memset(seen, 0, sizeof(*seen) * (mask + 1));
+    for (e = HT_(deref)(t, head); e != 0; e = HT_(deref)(t, e->next)) {
+      for (s = bloom_mix(HT_HASH(e->key)) & mask; seen[s] != 0; s = (s + 1) & mask) {
+        if (HT_EQ(seen[s]->key, e->key)) break;
+      }
+      if (seen[s] != 0) continue;
+      seen[s] = e;
+      w->fn(e->key, e->value, w->id, w->arg);
+    }
+  }
+  free(seen);
+  return NULL;
+}
+
+static void
+HT_(for_each)(struct HT_NAME *t, int nthreads,
+              void (*fn)(HT_KEY, HT_VALUE, int, void *), void *arg)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthreads);
+  struct HT_(eachworker) *w = malloc(sizeof(*w) * nthreads);
+  HT_(link) *h;
+  uint32_t epoch;
+  void *value;
+  int i;
+
+  assert(tha && w);
+  pthread_mutex_lock(&t->snaplock);
+  if (t->snaphead == NULL) {
+    t->snapepoch = calloc(t->nbucket, sizeof(uint32_t));
+    h = calloc(t->nbucket, sizeof(HT_(link)));
+    assert(t->snapepoch && h);
+    __atomic_store_n(&t->snaphead, h, __ATOMIC_RELEASE);
+  }
+  epoch = __sync_add_and_fetch(&t->epoch, 1);
+  for (i = 0; i < nthreads; i++) {
+    w[i].t = t;
+    w[i].lo = (long) t->nbucket * i / nthreads;
+    w[i].hi = (long) t->nbucket * (i + 1) / nthreads;
+    w[i].id = i;
+    w[i].epoch = epoch;
+    w[i].fn = fn;
+    w[i].arg = arg;
+    assert(pthread_create(&tha[i], NULL, HT_(eachthread), &w[i]) == 0);
+  }
+  for (i = 0; i < nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+  pthread_mutex_unlock(&t->snaplock);
+  free(w);
+  free(tha);
+}
+
+// Parallel statistics: each thread measures a range of buckets.
+
+struct HT_(statsworker) {
+  struct HT_NAME *t;
+  long lo, hi;
+  struct ht_stats s;
+};
+
+static void *
+HT_(statsthread)(void *xa)
+{
+  struct HT_(statsworker) *w = xa;
+  struct HT_NAME *t = w->t;
+  struct HT_(entry) *e;
+  long b, len;
+
+  for (b = w->lo; b < w->hi; b++) {
+    len = 0;
+    for (e = HT_(deref)(t, t->table[b]); e != 0; e = HT_(deref)(t, e->next)) {
+#ifndef HT_COMPACT
+      w->s.bytes += ht_chunk(e);
+#endif
+      len++;
+    }
+    w->s.nentry += len;
+    if (len == 0) w->s.empty++;
+    if (len > w->s.longest) w->s.longest = len;
+    w->s.hist[len < HT_HISTMAX ? len : HT_HISTMAX]++;
+  }
+  return NULL;
+}
+
+static void
+HT_(stats)(struct HT_NAME *t, int nthreads, struct ht_stats *s)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthreads);
+  struct HT_(statsworker) *w = calloc(nthreads, sizeof(*w));
+  void *value;
+  int i, j;
+
+  memset(s, 0, sizeof(*s));
+  s->nbucket = t->nbucket;
+  s->bytes = ht_chunk(t->locks) + ht_chunk(t->table) + ht_chunk((void *) t->pub) +
+    ht_chunk(t->snaphead) + ht_chunk(t->snapepoch);
+  if (t->bloom) s->bytes += ht_chunk(t->bloom) + ht_chunk(t->bloom->blocks);
+#ifdef HT_COMPACT
+  s->bytes += ht_chunk(t->pool);
+#endif
+  for (i = 0; i < nthreads; i++) {
+    w[i].t = t;
+    w[i].lo = (long) t->nbucket * i / nthreads;
+    w[i].hi = (long) t->nbucket * (i + 1) / nthreads;
+    assert(pthread_create(&tha[i], NULL, HT_(statsthread), &w[i]) == 0);
+  }
+  for (i = 0; i < nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+    s->bytes += w[i].s.bytes;
+    s->nentry += w[i].s.nentry;
+    s->empty += w[i].s.empty;
+    if (w[i].s.longest > s->longest) s->longest = w[i].s.longest;
+    for (j = 0; j <= HT_HISTMAX; j++) {
+      s->hist[j] += w[i].s.hist[j];
+    }
+  }
+  free(w);
+  free(tha);
+}
+
+static void
+HT_(report)(struct HT_NAME *t, long n)
+{
+  printf("layout: %zu-byte entries, %.1f bytes/key\n", sizeof(struct HT_(entry)),
+         (double) HT_(bytes)(t) / n);
+}
+
+#define HT_CHAINED
@@ -0,0 +1,338 @@
+// Binary operation traces for the hw6 tables: record the puts and gets a
+// workload makes, then replay them against any backend. Include after the
+// table header, with the same HT_ parameters; keys and values are stored
+// as their bytes, so they must not point elsewhere.
+//
+// A trace is a header and then chunks. Each chunk is one recording
+// thread's next TRACE_CHUNK (or fewer) records, each a packed (time, op,
+// key, value), so a record costs 9 bytes plus the key and value. Chunks
+// are written as threads fill them, with one write each.
+//
+// A recording thread calls trace_phase as it reaches a barrier between
+// phases of the workload, such as the puts and the gets. That writes out
+// its chunk, and later chunks carry the next phase number, so every
+// chunk of a phase is in the file before any chunk of the next.
+//
+// HT_(replay) mmaps the trace and streams through it: replay thread i of
+// n takes the chunks of recording threads i, i + n, ..., skipping the rest
+// by their headers, and drops each chunk's pages once done, so traces
+// bigger than memory replay too. Replay threads meet at a barrier where
+// the phase changes, as the recording threads did. One recorded thread's
+// operations replay in order, on one thread, either at full speed or at
+// their recorded times; within a phase at full speed, operations of
+// different recorded threads may replay in another order than they ran.
+// The recorder uses now(), and the replay spinbarrier_wait(), from hw6.c.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HW6TRACE_H
+#define HW6TRACE_H
+
+#define TRACE_MAGIC 0x50364857    // "WH6P", phased
+#define TRACE_CHUNK 4096          // records per chunk
+
+enum { TRACE_PUT, TRACE_GET };
+
+struct trace_header {
+  uint32_t magic;
+  uint16_t keysize;
+  uint16_t valuesize;
+  uint64_t nrec;
+  uint64_t nchunk;
+  uint64_t nphase;
+};
+
+struct trace_chunk {
+  uint32_t thread;
+  uint32_t nrec;
+  uint32_t phase;
+};
+
+struct tracebuf {
+  char *data;
+  uint32_t nrec;
+  uint32_t phase;
+} __attribute__((aligned(64)));
+
+struct trace {
+  int fd;
+  int nthreads;
+  size_t recsize;
+  double start;             // now() when recording began
+  struct tracebuf *bufs;
+  pthread_mutex_t lock;     // the file and the totals
+  struct trace_header h;
+};
+
+static struct trace *
+trace_create(const char *path, int nthreads, int keysize, int valuesize, size_t recsize)
+{
+  struct trace *tr = calloc(1, sizeof(struct trace));
+  int i;
+
+  assert(tr);
+  tr->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(tr->fd >= 0);
+  tr->nthreads = nthreads;
+  tr->recsize = recsize;
+  tr->h.magic = TRACE_MAGIC;
+  tr->h.keysize = keysize;
+  tr->h.valuesize = valuesize;
+  tr->h.nphase = 1;
+  tr->bufs = aligned_alloc(64, sizeof(struct tracebuf) * nthreads);
+  assert(tr->bufs);
+  for (i = 0; i < nthreads; i++) {
+    tr->bufs[i].data = malloc(sizeof(struct trace_chunk) + recsize * TRACE_CHUNK);
+    tr->bufs[i].nrec = 0;
+    tr->bufs[i].phase = 0;
+    assert(tr->bufs[i].data);
+  }
+  pthread_mutex_init(&tr->lock, NULL);
+  assert(write(tr->fd, &tr->h, sizeof(tr->h)) == sizeof(tr->h));
+  tr->start = now();
+  return tr;
+}
+
+static void
+trace_flush(struct trace *tr, int thread)
+{
+  struct tracebuf *b = &tr->bufs[thread];
+  struct trace_chunk *c = (struct trace_chunk *) b->data;
+  size_t n = sizeof(*c) + tr->recsize * b->nrec;
+
+  if (b->nrec == 0) return;
+  c->thread = thread;
+  c->nrec = b->nrec;
+  c->phase = b->phase;
+  pthread_mutex_lock(&tr->lock);
+  assert(write(tr->fd, b->data, n) == (ssize_t) n);
+  tr->h.nrec += b->nrec;
+  tr->h.nchunk++;
+  pthread_mutex_unlock(&tr->lock);
+  b->nrec = 0;
+}
+
+// Room for thread's next record, to be filled in before its next call.
+static inline void *
+trace_next(struct trace *tr, int thread)
+{
+  struct tracebuf *b = &tr->bufs[thread];
+
+  if (b->nrec == TRACE_CHUNK) trace_flush(tr, thread);
+  return b->data + sizeof(struct trace_chunk) + tr->recsize * b->nrec++;
+}
+
+// thread is at the barrier before the next phase; call before waiting.
+static void
+trace_phase(struct trace *tr, int thread)
+{
+  struct tracebuf *b = &tr->bufs[thread];
+
+  trace_flush(tr, thread);
+  b->phase++;
+  pthread_mutex_lock(&tr->lock);
+  if (b->phase + 1 > tr->h.nphase) tr->h.nphase = b->phase + 1;
+  pthread_mutex_unlock(&tr->lock);
+}
+
+// Flush every thread's last chunk, complete the header and close.
+static void
+trace_close(struct trace *tr)
+{
+  int i;
+
+  for (i = 0; i < tr->nthreads; i++) {
+    trace_flush(tr, i);
+    free(tr->bufs[i].data);
+  }
+  assert(pwrite(tr->fd, &tr->h, sizeof(tr->h), 0) == sizeof(tr->h));
+  close(tr->fd);
+  pthread_mutex_destroy(&tr->lock);
+  free(tr->bufs);
+  free(tr);
+}
+
+// Wait until the time of a record at ns into a replay that began at start.
+static void
+trace_pace(double start, uint64_t ns)
+{
+  double ahead = ns / 1e9 - (now() - start);
+  struct timespec ts;
+
+  if (ahead > 0.001) {
+    // sleep through most of it, then spin for precision
+    ahead -= 0.0005;
+    ts.tv_sec = (time_t) ahead;
+    ts.tv_nsec = (ahead - ts.tv_sec) * 1e9;
+    nanosleep(&ts, NULL);
+  }
+  while (now() - start < ns / 1e9) ;
+}
+
+#endif
+
+struct HT_(tracerec) {
+  uint64_t ns;              // since recording began
+  uint8_t op;
+  HT_KEY key;
+  HT_VALUE value;           // of a put; 0 for a get
+} __attribute__((packed));
+
+static inline void
+HT_(trace)(struct trace *tr, int thread, int op, HT_KEY key, HT_VALUE value)
+{
+  struct HT_(tracerec) *r = trace_next(tr, thread);
+
+  r->ns = (now() - tr->start) * 1e9;
+  r->op = op;
+  r->key = key;
+  r->value = value;
+}
+
+static struct trace *
+HT_(trace_create)(const char *path, int nthreads)
+{
+  return trace_create(path, nthreads, sizeof(HT_KEY), sizeof(HT_VALUE),
+                      sizeof(struct HT_(tracerec)));
+}
+
+struct HT_(replay) {
+  struct HT_NAME *t;
+  char *map;
+  size_t size;
+  int nthreads;
+  int paced;
+  double start;
+  uint32_t nphase;
+  struct spinbarrier bar;   // between phases
+};
+
+// Per replay thread: operations, gets, and gets that missed.
+struct HT_(replayed) {
+  long nop, nget, nmiss;
+} __attribute__((aligned(64)));
+
+struct HT_(replayworker) {
+  struct HT_(replay) *r;
+  int id;
+  struct HT_(replayed) res;
+};
+
+static void *
+HT_(replaythread)(void *xa)
+{
+  struct HT_(replayworker) *w = xa;
+  struct HT_(replay) *r = w->r;
+  size_t off = sizeof(struct trace_header), n;
+  struct trace_chunk *c;
+  struct HT_(tracerec) *rec;
+  uintptr_t lo, hi;
+  uint32_t i, phase = 0;
+
+  while (off + sizeof(*c) <= r->size) {
+    c = (struct trace_chunk *) (r->map + off);
+    n = sizeof(*c) + sizeof(*rec) * c->nrec;
+    assert(off + n <= r->size && c->phase < r->nphase);
+    // all of the last phase's chunks are before this one
+    for (; phase < c->phase; phase++) {
+      spinbarrier_wait(&r->bar, r->nthreads);
+    }
+    if (c->thread % r->nthreads == (uint32_t) w->id) {
+      rec = (struct HT_(tracerec) *) (c + 1);
+      for (i = 0; i < c->nrec; i++, rec++) {
+        if (r->paced) trace_pace(r->start, rec->ns);
+        if (rec->op == TRACE_PUT) {
+          HT_(put)(r->t, rec->key, rec->value);
+        } else {
+          w->res.nget++;
+          if (HT_(get)(r->t, rec->key) == 0) w->res.nmiss++;
+        }
+      }
+      w->res.nop += c->nrec;
+      // done with these pages; only whole pages inside the chunk go
+      lo = ((uintptr_t) c + 4095) & ~(uintptr_t) 4095;
+      hi = ((uintptr_t) c + n) & ~(uintptr_t) 4095;
+      if (hi > lo) madvise((void *) lo, hi - lo, MADV_DONTNEED);
+    }
+    off += n;
+  }
+  for (; phase + 1 < r->nphase; phase++) {
+    spinbarrier_wait(&r->bar, r->nthreads);
+  }
+  return NULL;
+}
+
+// Open the trace at path and return its record count, or -1 if it isn't
+// a trace of this key and value type.
+static long
+HT_(trace_count)(const char *path)
+{
+  struct trace_header h;
+  int fd = open(path, O_RDONLY);
+  ssize_t got;
+
+  assert(fd >= 0);
+  got = read(fd, &h, sizeof(h));
+  close(fd);
+  if (got != sizeof(h) || h.magic != TRACE_MAGIC || h.keysize != sizeof(HT_KEY) ||
+      h.valuesize != sizeof(HT_VALUE)) return -1;
+  return h.nrec;
+}
+
+// Replay the trace at path into t on nthreads threads, at full speed or
+// paced by the recorded times; res gets the totals.
+static void
+HT_(replay)(struct HT_NAME *t, const char *path, int nthreads, int paced,
+            struct HT_(replayed) *res)
+{
+  struct HT_(replay) r;
+  struct HT_(replayworker) *w = calloc(nthreads, sizeof(*w));
+  pthread_t *tha = malloc(sizeof(pthread_t) * nthreads);
+  struct stat st;
+  void *value;
+  int fd = open(path, O_RDONLY), i;
+
+  assert(w && tha && fd >= 0 && fstat(fd, &st) == 0);
+  r.t = t;
+  r.size = st.st_size;
+  r.map = mmap(NULL, r.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(r.map != MAP_FAILED);
+  close(fd);
+  madvise(r.map, r.size, MADV_SEQUENTIAL);
+  r.nphase = ((struct trace_header *) r.map)->nphase;
+  memset(&r.bar, 0, sizeof(r.bar));
+  r.nthreads = nthreads;
+  r.paced = paced;
+  r.start = now();
+  for (i = 0; i < nthreads; i++) {
+    w[i].r = &r;
+    w[i].id = i;
+    assert(pthread_create(&tha[i], NULL, HT_(replaythread), &w[i]) == 0);
+  }
+  memset(res, 0, sizeof(*res));
+  for (i = 0; i < nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+    res->nop += w[i].res.nop;
+    res->nget += w[i].res.nget;
+    res->nmiss += w[i].res.nmiss;
+  }
+  munmap(r.map, r.size);
+  free(tha);
+  free(w);
+}
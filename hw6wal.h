@@ -0,0 +1,411 @@
+// Write-ahead log with group commit, for any hw6 table backend: include
+// after the table header, with the same HT_ parameters. Keys and values
+// are logged as their bytes, so they must not point elsewhere.
+//
+// HT_(wal_put) appends a record to its thread's buffer before the put.
+// One commit thread swaps every thread's buffer out and writes them all
+// with a single writev and fdatasync. With a commit interval of 0 it
+// commits as soon as anything is waiting, and each put returns only once
+// its record is on disk; puts that arrive during one fdatasync share the
+// next. With an interval of N microseconds it commits every N, and puts
+// don't wait: a crash loses at most the last interval.
+//
+// HT_(wal_recover) replays a log into a table on several threads. Every
+// record carries a checksum, so a torn tail is found and dropped. The
+// threads then partition the records by key, as bulk_load does, so that
+// each replays the records of its own keys, in log order, having read
+// only its share of the log. Each thread's records replay in order; puts
+// of one key racing from two threads may replay in either order.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef HT_CAT
+#define HT_CAT_(a, b) a##b
+#define HT_CAT(a, b) HT_CAT_(a, b)
+#endif
+#undef HT_
+#define HT_(n) HT_CAT(HT_NAME, HT_CAT(_, n))
+
+#ifndef HW6WAL_H
+#define HW6WAL_H
+
+#define WAL_BUF 65536         // initial bytes of each thread buffer
+
+struct walbuf {
+  pthread_mutex_t lock;       // against the commit thread's swap
+  char *data, *spare;
+  size_t len, cap, sparecap;
+  long appended;              // records appended so far
+  volatile long durable;      // of which on disk
+} __attribute__((aligned(64)));
+
+struct wal {
+  int fd;
+  int nthreads;
+  long interval;              // microseconds between commits; 0: at once
+  struct walbuf *bufs;
+  pthread_t committer;
+  pthread_mutex_t lock;       // pending and stop, and the conditions
+  pthread_cond_t kick;        // records are waiting (interval 0)
+  pthread_cond_t synced;      // a commit finished
+  int pending;
+  int stop;
+  long nsync;                 // commits made
+};
+
+// Swap out every buffer, write them and sync; returns bytes written.
+static size_t
+wal_commit(struct wal *w)
+{
+  struct iovec *iov = malloc(sizeof(struct iovec) * w->nthreads);
+  long *upto = malloc(sizeof(long) * w->nthreads);
+  size_t total = 0;
+  char *p;
+  int i, n = 0;
+
+  assert(iov && upto);
+  for (i = 0; i < w->nthreads; i++) {
+    struct walbuf *b = &w->bufs[i];
+    size_t c;
+
+    pthread_mutex_lock(&b->lock);
+    upto[i] = b->appended;
+    if (b->len > 0) {
+      iov[n].iov_base = b->data;
+      iov[n++].iov_len = b->len;
+      total += b->len;
+      p = b->data, b->data = b->spare, b->spare = p;
+      c = b->cap, b->cap = b->sparecap, b->sparecap = c;
+      b->len = 0;
+    }
+    pthread_mutex_unlock(&b->lock);
+  }
+  if (n > 0) {
+    assert(writev(w->fd, iov, n) == (ssize_t) total);
+    assert(fdatasync(w->fd) == 0);
+    w->nsync++;
+  }
+  for (i = 0; i < w->nthreads; i++) {
+    __atomic_store_n(&w->bufs[i].durable, upto[i], __ATOMIC_RELEASE);
+  }
+  if (w->interval == 0) {
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_broadcast(&w->synced);
+    pthread_mutex_unlock(&w->lock);
+  }
+  free(iov);
+  free(upto);
+  return total;
+}
+
+static void *
+wal_committer(void *xa)
+{
+  struct wal *w = xa;
+  struct timespec ts;
+  int stop;
+
+  for (;;) {
+    if (w->interval > 0) {
+      ts.tv_sec = w->interval / 1000000;
+      ts.tv_nsec = w->interval % 1000000 * 1000;
+      nanosleep(&ts, NULL);
+      pthread_mutex_lock(&w->lock);
+    } else {
+      pthread_mutex_lock(&w->lock);
+      while (!w->pending && !w->stop) pthread_cond_wait(&w->kick, &w->lock);
+      w->pending = 0;
+    }
+    stop = w->stop;
+    pthread_mutex_unlock(&w->lock);
+    // after stop, one last commit takes whatever came before it
+    if (wal_commit(w) == 0 && stop) break;
+  }
+  return NULL;
+}
+
+// Create (truncate) the log at path for threads 0..nthreads-1.
+static struct wal *
+wal_open(const char *path, int nthreads, long interval)
+{
+  struct wal *w = calloc(1, sizeof(struct wal));
+  int i;
+
+  assert(w);
+  w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  assert(w->fd >= 0);
+  w->nthreads = nthreads;
+  w->interval = interval;
+  w->bufs = aligned_alloc(64, sizeof(struct walbuf) * nthreads);
+  assert(w->bufs);
+  memset(w->bufs, 0, sizeof(struct walbuf) * nthreads);
+  for (i = 0; i < nthreads; i++) {
+    pthread_mutex_init(&w->bufs[i].lock, NULL);
+    w->bufs[i].data = malloc(WAL_BUF);
+    w->bufs[i].spare = malloc(WAL_BUF);
+    assert(w->bufs[i].data && w->bufs[i].spare);
+    w->bufs[i].cap = w->bufs[i].sparecap = WAL_BUF;
+  }
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->kick, NULL);
+  pthread_cond_init(&w->synced, NULL);
+  assert(pthread_create(&w->committer, NULL, wal_committer, w) == 0);
+  return w;
+}
+
+// Commit what is left, stop the commit thread and close the log.
+// Returns the number of commits made.
+static long
+wal_close(struct wal *w)
+{
+  long nsync;
+  void *value;
+  int i;
+
+  pthread_mutex_lock(&w->lock);
+  w->stop = 1;
+  pthread_cond_signal(&w->kick);
+  pthread_mutex_unlock(&w->lock);
+  assert(pthread_join(w->committer, &value) == 0);
+  nsync = w->nsync;
+  close(w->fd);
+  for (i = 0; i < w->nthreads; i++) {
+    pthread_mutex_destroy(&w->bufs[i].lock);
+    free(w->bufs[i].data);
+    free(w->bufs[i].spare);
+  }
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->kick);
+  pthread_cond_destroy(&w->synced);
+  free(w->bufs);
+  free(w);
+  return nsync;
+}
+
+// Append n bytes to thread id's buffer; returns the record's number.
+static long
+wal_append(struct wal *w, int id, const void *rec, size_t n)
+{
+  struct walbuf *b = &w->bufs[id];
+  long seq;
+
+  pthread_mutex_lock(&b->lock);
+  if (b->len + n > b->cap) {
+    b->cap *= 2;
+    b->data = realloc(b->data, b->cap);
+    assert(b->data);
+  }
+  memcpy(b->data + b->len, rec, n);
+  b->len += n;
+  seq = ++b->appended;
+  pthread_mutex_unlock(&b->lock);
+  return seq;
+}
+
+// Wait until thread id's record seq is on disk.
+static void
+wal_wait(struct wal *w, int id, long seq)
+{
+  struct walbuf *b = &w->bufs[id];
+
+  pthread_mutex_lock(&w->lock);
+  w->pending = 1;
+  pthread_cond_signal(&w->kick);
+  while (__atomic_load_n(&b->durable, __ATOMIC_ACQUIRE) < seq) {
+    pthread_cond_wait(&w->synced, &w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+static inline uint32_t
+wal_check(const unsigned char *p, size_t n)
+{
+  uint32_t h = 0x811c9dc5;
+
+  while (n-- > 0) h = (h ^ *p++) * 0x01000193;
+  return h;
+}
+
+#endif
+
+struct HT_(walrec) {
+  uint32_t check;           // wal_check of the bytes after it
+  HT_KEY key;
+  HT_VALUE value;
+};
+
+static inline uint32_t
+HT_(walcheck)(struct HT_(walrec) *r)
+{
+  return wal_check((unsigned char *) r + sizeof(uint32_t), sizeof(*r) - sizeof(uint32_t));
+}
+
+// put(), logged ahead from thread id.
+static void
+HT_(wal_put)(struct HT_NAME *t, struct wal *w, int id, HT_KEY key, HT_VALUE value)
+{
+  struct HT_(walrec) r;
+  long seq;
+
+  memset(&r, 0, sizeof(r));   // padding too, for the checksum
+  r.key = key;
+  r.value = value;
+  r.check = HT_(walcheck)(&r);
+  seq = wal_append(w, id, &r, sizeof(r));
+  HT_(put)(t, key, value);
+  if (w->interval == 0) wal_wait(w, id, seq);
+}
+
+struct HT_(recovery) {
+  struct HT_NAME *t;
+  struct HT_(walrec) *recs;
+  long n;                   // records in the file; then the valid ones
+  int nthreads;
+  int phase;
+  long *bad;                // per thread, its first bad record or n
+  long *hist;               // nthreads x nthreads counts, then offsets
+  long *start;              // nthreads+1 boundaries of each owner's records
+  long *order;              // record indices, by owner, in log order
+};
+
+struct HT_(recoverworker) {
+  struct HT_(recovery) *r;
+  int id;
+};
+
+// The thread that replays key.
+static inline int
+HT_(recoverowner)(struct HT_(recovery) *r, HT_KEY key)
+{
+  return HT_HASH(key) % r->nthreads;
+}
+
+static void *
+HT_(recoverthread)(void *xa)
+{
+  struct HT_(recoverworker) *w = xa;
+  struct HT_(recovery) *r = w->r;
+  long lo = r->n * w->id / r->nthreads;
+  long hi = r->n * (w->id + 1) / r->nthreads;
+  long *h = r->hist + (long) w->id * r->nthreads;
+  long i;
+
+  switch (r->phase) {
+  case 0:  // check this thread's slice
+    for (i = lo; i < hi && HT_(walcheck)(&r->recs[i]) == r->recs[i].check; i++) ;
+    r->bad[w->id] = i < hi ? i : r->n;
+    break;
+  case 1:  // count the valid ones by owner
+    for (i = lo; i < hi; i++) {
+      h[HT_(recoverowner)(r, r->recs[i].key)]++;
+    }
+    break;
+  case 2:  // list them under their owners
+    for (i = lo; i < hi; i++) {
+      r->order[h[HT_(recoverowner)(r, r->recs[i].key)]++] = i;
+    }
+    break;
+  case 3:  // replay this thread's own
+    for (i = r->start[w->id]; i < r->start[w->id + 1]; i++) {
+      HT_(put)(r->t, r->recs[r->order[i]].key, r->recs[r->order[i]].value);
+    }
+    break;
+  }
+  return NULL;
+}
+
+static void
+HT_(recoverphase)(struct HT_(recovery) *r, int phase)
+{
+  pthread_t *tha = malloc(sizeof(pthread_t) * r->nthreads);
+  struct HT_(recoverworker) *w = malloc(sizeof(*w) * r->nthreads);
+  void *value;
+  int i;
+
+  assert(tha && w);
+  r->phase = phase;
+  for (i = 0; i < r->nthreads; i++) {
+    w[i].r = r;
+    w[i].id = i;
+    assert(pthread_create(&tha[i], NULL, HT_(recoverthread), &w[i]) == 0);
+  }
+  for (i = 0; i < r->nthreads; i++) {
+    assert(pthread_join(tha[i], &value) == 0);
+  }
+  free(w);
+  free(tha);
+}
+
+// Owner-major, slice-order offsets from the counts in r->hist, so each
+// owner's records stay in log order; r->start gets the boundaries.
+static void
+HT_(recoveroffsets)(struct HT_(recovery) *r)
+{
+  long off = 0, c;
+  int i, p;
+
+  for (p = 0; p < r->nthreads; p++) {
+    r->start[p] = off;
+    for (i = 0; i < r->nthreads; i++) {
+      c = r->hist[(long) i * r->nthreads + p];
+      r->hist[(long) i * r->nthreads + p] = off;
+      off += c;
+    }
+  }
+  r->start[r->nthreads] = off;
+}
+
+// Replay the log at path into t, which must be init'd, on nthreads
+// threads. Returns the number of records replayed.
+static long
+HT_(wal_recover)(struct HT_NAME *t, const char *path, int nthreads)
+{
+  struct HT_(recovery) r;
+  struct stat st;
+  void *map = NULL;
+  int fd = open(path, O_RDONLY), i;
+
+  assert(fd >= 0 && fstat(fd, &st) == 0);
+  r.t = t;
+  r.nthreads = nthreads;
+  r.n = st.st_size / sizeof(struct HT_(walrec));  // a partial last record is torn
+  r.bad = malloc(sizeof(long) * nthreads);
+  assert(r.bad);
+  if (r.n > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(map != MAP_FAILED);
+    r.recs = map;
+    HT_(recoverphase)(&r, 0);
+    for (i = 0; i < nthreads; i++) {
+      if (r.bad[i] < r.n) {
+        r.n = r.bad[i];   // everything after the first bad record is lost
+        break;
+      }
+    }
+    r.hist = calloc((long) nthreads * nthreads, sizeof(long));
+    r.start = malloc(sizeof(long) * (nthreads + 1));
+    r.order = malloc(sizeof(long) * (r.n + 1));
+    assert(r.hist && r.start && r.order);
+    HT_(recoverphase)(&r, 1);
+    HT_(recoveroffsets)(&r);
+    HT_(recoverphase)(&r, 2);
+    HT_(recoverphase)(&r, 3);
+    free(r.hist);
+    free(r.start);
+    free(r.order);
+    munmap(map, st.st_size);
+  }
+  close(fd);
+  free(r.bad);
+  return r.n;
+}